@@ -0,0 +1,117 @@
+// buffer storage benchmark: times object_write() and object_read() on VBO and
+// SBO ranges, with the object used by the GPU between each write and read,
+// once with persistently mapped stores and once with has_buffer_storage forced
+// off so stores use glBufferSubData()/glGetBufferSubData(). the calling thread
+// stands in for the GPU thread, so it owns the GL context. runs under Mesa
+// llvmpipe with LIBGL_ALWAYS_SOFTWARE=1.
+//
+// build from this directory, linking the GPU sources except main.c:
+//   cc -O2 -I.. -o buffer_bench buffer_bench.c
+//       $(ls ../*.c | grep -v main.c) -lGL -lglfw -lm -lpthread
+//   ./buffer_bench [n_iterations]
+#include "../../../defs.h"
+
+#define DEFAULT_ITERATIONS	1000
+#define N_SIZES				3
+#define OBJECT_SPACING		0x200000	/* keeps every object in its own store */
+#define PERSISTENT_BASE		0x1000000
+#define FALLBACK_BASE		0x4000000
+
+uint8_t ram[RAM_CAPACITY];
+GLFWwindow* window;
+
+GLFWwindow* get_window()				{ return window; }
+uint8_t* get_ram()						{ return ram; }
+void page_flip_irq()					{}
+void dma_read_complete_irq()			{}
+void dma_write_complete_irq()			{}
+void fence_irq()						{}
+void gpu_flip(uint64_t a, uint8_t v)	{}
+void gpu_batch()						{}
+
+uint8_t atomic_get_u8(uint8_t* var)				{ return __atomic_load_n(var, __ATOMIC_ACQUIRE); }
+uint64_t atomic_get_u64(uint64_t* var)			{ return __atomic_load_n(var, __ATOMIC_ACQUIRE); }
+void atomic_set_u8(uint8_t* var, uint8_t val)	{ __atomic_store_n(var, val, __ATOMIC_RELEASE); }
+void atomic_set_u64(uint64_t* var, uint64_t val)	{ __atomic_store_n(var, val, __ATOMIC_RELEASE); }
+
+extern int8_t has_buffer_storage;
+
+uint64_t sizes[N_SIZES] = { 0x1000, 0x10000, 0x100000 };
+uint8_t types[2] = { TYPE_VBO, TYPE_SBO };
+char* type_names[2] = { "VBO", "SBO" };
+
+// write, flush as a draw would, mark GPU use and read back, n times. returns
+// the average write and read times in us.
+void time_object(object_t* obj, uint32_t n_iterations, double* write_us,
+	double* read_us) {
+	uint8_t* src = malloc(obj->len);
+	uint8_t* dst = malloc(obj->len);
+	uint64_t write_ns = 0, read_ns = 0;
+
+	for(uint32_t i = 0; i < n_iterations; i++) {
+		memset(src, i, obj->len);
+		memcpy(vram + obj->addr, src, obj->len);	// object_write() expects VRAM updated
+
+		uint64_t start = now_ns();
+		object_write(obj, obj->addr, src, obj->len);
+		flush_dirty(obj);
+		mark_gpu_use(obj);
+		write_ns += now_ns() - start;
+
+		start = now_ns();
+		object_read(obj, dst, obj->addr, obj->len);
+		read_ns += now_ns() - start;
+
+		if(dst[obj->len - 1] != (uint8_t)i)
+			WARN("%llx read back stale data\n", (unsigned long long)obj->addr);
+	}
+
+	*write_us = write_ns / 1e3 / n_iterations;
+	*read_us = read_ns / 1e3 / n_iterations;
+	free(src);
+	free(dst);
+}
+
+void run_pass(char* name, uint64_t base, uint32_t n_iterations) {
+	printf("%s:\n", name);
+	for(uint32_t t = 0; t < 2; t++)
+		for(uint32_t s = 0; s < N_SIZES; s++) {
+			uint64_t addr = base + (t * N_SIZES + s) * OBJECT_SPACING;
+			object_t* obj = ref_buffer_precise(addr, types[t], sizes[s]);
+			if(!obj)
+				ERROR("failed to create %s %llx\n", type_names[t],
+					(unsigned long long)addr);
+
+			double write_us, read_us;
+			time_object(obj, n_iterations, &write_us, &read_us);
+			printf("  %s %7llu bytes: write %9.2f us, read %9.2f us%s\n",
+				type_names[t], (unsigned long long)sizes[s], write_us, read_us,
+				obj->store && obj->store->gl_map ? "" : " (unmapped)");
+		}
+}
+
+int main(int argc, char** argv) {
+	uint32_t n_iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+
+	if(!glfwInit())
+		ERROR("failed to initialize glfw\n");
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	window = glfwCreateWindow(1, 1, "", NULL, NULL);
+	if(!window)
+		ERROR("failed to create window\n");
+	glfwMakeContextCurrent(window);
+	init_fences(0);
+
+	if(!use_persistent_buffers())
+		printf("buffer storage unavailable, both passes are unmapped\n");
+	run_pass("persistent mapping", PERSISTENT_BASE, n_iterations);
+
+	// stores created from here on use the fallback path
+	has_buffer_storage = 0;
+	run_pass("glBufferSubData fallback", FALLBACK_BASE, n_iterations);
+
+	glfwTerminate();
+	return 0;
+}
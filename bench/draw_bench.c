@@ -0,0 +1,164 @@
+// draw batching benchmark: dispatches a CBO of same-state CMD_DRAWs that only
+// change base index and count, once as multi-draw runs and once with a base
+// instance set, which keeps every draw its own GL call. the calling thread
+// stands in for the GPU thread, so it owns the GL context. runs under Mesa
+// llvmpipe with LIBGL_ALWAYS_SOFTWARE=1.
+//
+// build from this directory, linking the GPU sources except main.c:
+//   cc -O2 -I.. -o draw_bench draw_bench.c
+//       $(ls ../*.c | grep -v main.c) -lGL -lglfw -lm -lpthread
+//   ./draw_bench [n_draws] [n_iterations]
+#include "../../../defs.h"
+
+#define DEFAULT_DRAWS		500
+#define DEFAULT_ITERATIONS	200
+#define TARGET_DIM			256
+
+#define KERNEL_ADDR		0x1000
+#define VBO_ADDR		0x2000
+#define VBO_LEN			0x1000
+#define TBO_ADDR		0x10000
+#define MERGED_CBO_ADDR	0x100000
+#define SINGLE_CBO_ADDR	0x200000
+
+uint8_t ram[RAM_CAPACITY];
+GLFWwindow* window;
+
+GLFWwindow* get_window()				{ return window; }
+uint8_t* get_ram()						{ return ram; }
+void page_flip_irq()					{}
+void dma_read_complete_irq()			{}
+void dma_write_complete_irq()			{}
+void fence_irq()						{}
+void gpu_flip(uint64_t a, uint8_t v)	{}
+void gpu_batch()						{}
+
+uint8_t atomic_get_u8(uint8_t* var)				{ return __atomic_load_n(var, __ATOMIC_ACQUIRE); }
+uint64_t atomic_get_u64(uint64_t* var)			{ return __atomic_load_n(var, __ATOMIC_ACQUIRE); }
+void atomic_set_u8(uint8_t* var, uint8_t val)	{ __atomic_store_n(var, val, __ATOMIC_RELEASE); }
+void atomic_set_u64(uint64_t* var, uint64_t val)	{ __atomic_store_n(var, val, __ATOMIC_RELEASE); }
+
+uint8_t* put_reg_32(uint8_t* cmd, uint64_t reg, uint32_t value) {
+	*(uint16_t*)cmd = CMD_SET_REG_32;
+	*(uint64_t*)(cmd + 2) = reg;
+	*(uint32_t*)(cmd + 10) = value;
+	return cmd + 14;
+}
+
+uint8_t* put_reg_64(uint8_t* cmd, uint64_t reg, uint64_t value) {
+	*(uint16_t*)cmd = CMD_SET_REG_64;
+	*(uint64_t*)(cmd + 2) = reg;
+	*(uint64_t*)(cmd + 10) = value;
+	return cmd + 18;
+}
+
+// kernel instructions are 6 bytes here, fields packed from bit 0
+uint8_t* put_ins(uint8_t* p, uint64_t bits) {
+	memcpy(p, &bits, 6);
+	return p + 6;
+}
+
+// a kernel placing every vertex at the origin, so draws cost their submission
+void write_kernel() {
+	uint8_t k[8 + 20 + 36];
+	memset(k, 0, sizeof(k));
+	uint8_t* bin = k + 8;
+	*(uint32_t*)bin = 2;			// stages
+	*(uint32_t*)(bin + 4) = 30;		// vertex stage: 4 movs and a vout
+	*(uint32_t*)(bin + 8) = 6;		// fragment stage: one mov
+
+	uint32_t one = 0x3F800000;
+	uint8_t* p = bin + 20;
+	for(uint64_t r = 0; r < 4; r++)
+		p = put_ins(p, OP_MOV | r << 7 | (uint64_t)(r == 3 ? one : 0) << 15);
+	p = put_ins(p, OP_VOUT | (uint64_t)0x03020100 << 7);
+	p = put_ins(p, OP_MOV);
+
+	*(uint64_t*)k = p - bin;
+	gpu_write(KERNEL_ADDR, k, p - k);
+}
+
+// n draws of 3 vertices sharing all state, from a base instance if single
+void write_draw_cbo(uint64_t addr, uint32_t n_draws, uint8_t single) {
+	uint64_t len = 4 + 256 + (uint64_t)n_draws * 38 + 1;
+	uint8_t* cbo = calloc(1, len);
+	uint8_t* cmd = cbo + 4;
+	cmd = put_reg_32(cmd, FB_CFG_REG, 1);
+	cmd = put_reg_64(cmd, COLOR_ATTACH_0_REG, TBO_ADDR);
+	cmd = put_reg_32(cmd, VIEW_SIZE_X_REG, TARGET_DIM);
+	cmd = put_reg_32(cmd, VIEW_SIZE_Y_REG, TARGET_DIM);
+	cmd = put_reg_64(cmd, KERNEL_ADDR_REG, KERNEL_ADDR);
+	cmd = put_reg_64(cmd, VBO_ADDR_REG, VBO_ADDR);
+	cmd = put_reg_64(cmd, VBO_LEN_REG, VBO_LEN);
+	cmd = put_reg_32(cmd, DRAW_CFG_REG, TOPOLOGY_TRIANGLES);
+	cmd = put_reg_32(cmd, BASE_INSTANCE_REG, single);
+
+	for(uint32_t i = 0; i < n_draws; i++) {
+		cmd = put_reg_64(cmd, BASE_IDX_REG, (i % 64) * 3);
+		cmd = put_reg_64(cmd, IDX_COUNT_REG, 3);
+		*(uint16_t*)cmd = CMD_DRAW;
+		cmd += 2;
+	}
+
+	// one byte of padding, decoding stops a byte short of the end
+	*(uint32_t*)cbo = cmd - (cbo + 4) + 1;
+	gpu_write(addr, cbo, cmd - cbo + 1);
+	free(cbo);
+}
+
+// returns the average time per dispatch, including the GL work it submits
+double time_dispatch(uint64_t addr, uint32_t n_iterations, draw_stats_t* stats) {
+	dispatch_cmd_buffer(addr, 0);		// warm up caches and build the kernel
+	glFinish();
+	reset_draw_stats();
+
+	uint64_t start = now_ns();
+	for(uint32_t i = 0; i < n_iterations; i++)
+		dispatch_cmd_buffer(addr, 0);
+	glFinish();
+	double ms = (now_ns() - start) / 1e6 / n_iterations;
+
+	*stats = *get_draw_stats();
+	return ms;
+}
+
+int main(int argc, char** argv) {
+	uint32_t n_draws = argc > 1 ? atoi(argv[1]) : DEFAULT_DRAWS;
+	uint32_t n_iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+	if(!glfwInit())
+		ERROR("failed to initialize glfw\n");
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	window = glfwCreateWindow(1, 1, "", NULL, NULL);
+	if(!window)
+		ERROR("failed to create window\n");
+	glfwMakeContextCurrent(window);
+	init_fences(0);
+
+	uint8_t header[14];
+	*(uint16_t*)header = (2 << 13) | FORMAT_RGBA_8;
+	uint32_t dims[3] = { TARGET_DIM, TARGET_DIM, 1 };
+	memcpy(header + 2, dims, 12);
+	gpu_write(TBO_ADDR, header, sizeof(header));
+
+	write_kernel();
+	write_draw_cbo(MERGED_CBO_ADDR, n_draws, 0);
+	write_draw_cbo(SINGLE_CBO_ADDR, n_draws, 1);
+
+	draw_stats_t merged, single;
+	double merged_ms = time_dispatch(MERGED_CBO_ADDR, n_iterations, &merged);
+	double single_ms = time_dispatch(SINGLE_CBO_ADDR, n_iterations, &single);
+
+	printf("%u draws per CBO, %u dispatches\n", n_draws, n_iterations);
+	printf("multi-draw runs: %.3f ms/CBO, %llu draws in %llu GL calls\n", merged_ms,
+		(unsigned long long)merged.draws, (unsigned long long)merged.gl_draw_calls);
+	printf("draw per call:   %.3f ms/CBO, %llu draws in %llu GL calls\n", single_ms,
+		(unsigned long long)single.draws, (unsigned long long)single.gl_draw_calls);
+	printf("throughput: %.0f vs %.0f draws/s\n", n_draws / merged_ms * 1000,
+		n_draws / single_ms * 1000);
+
+	glfwTerminate();
+	return 0;
+}
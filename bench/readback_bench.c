@@ -0,0 +1,157 @@
+// readback benchmark: clears a 4K RGBA render target and DMA-reads it to RAM
+// every frame, first through a synchronous flush_object() like reads did
+// before readbacks, then through start_dma() and the async readback path. the
+// calling thread stands in for the GPU thread, so it owns the GL context.
+//
+// build from this directory, linking the GPU sources except main.c:
+//   cc -O2 -I.. -o readback_bench readback_bench.c
+//       $(ls ../*.c | grep -v main.c) -lGL -lglfw -lm -lpthread
+//   ./readback_bench [n_frames]
+#include "../../../defs.h"
+
+#define DEFAULT_FRAMES	120
+#define TARGET_W		3840
+#define TARGET_H		2160
+#define TARGET_BYTES	((uint64_t)TARGET_W * TARGET_H * 4)
+
+#define CBO_ADDR		0x1000
+#define TBO_ADDR		0x100000
+#define TBO_HEADER_LEN	14
+#define DESC_ADDR		0x1000		/* RAM, the descriptor status is polled */
+#define DST_ADDR		0x100000	/* RAM */
+
+uint8_t ram[RAM_CAPACITY];
+GLFWwindow* window;
+
+GLFWwindow* get_window()				{ return window; }
+uint8_t* get_ram()						{ return ram; }
+void page_flip_irq()					{}
+void dma_read_complete_irq()			{}
+void dma_write_complete_irq()			{}
+void fence_irq()						{}
+void gpu_flip(uint64_t a, uint8_t v)	{}
+void gpu_batch()						{}
+
+uint8_t atomic_get_u8(uint8_t* var)				{ return __atomic_load_n(var, __ATOMIC_ACQUIRE); }
+uint64_t atomic_get_u64(uint64_t* var)			{ return __atomic_load_n(var, __ATOMIC_ACQUIRE); }
+void atomic_set_u8(uint8_t* var, uint8_t val)	{ __atomic_store_n(var, val, __ATOMIC_RELEASE); }
+void atomic_set_u64(uint64_t* var, uint64_t val)	{ __atomic_store_n(var, val, __ATOMIC_RELEASE); }
+
+uint8_t* put_reg_32(uint8_t* cmd, uint64_t reg, uint32_t value) {
+	*(uint16_t*)cmd = CMD_SET_REG_32;
+	*(uint64_t*)(cmd + 2) = reg;
+	*(uint32_t*)(cmd + 10) = value;
+	return cmd + 14;
+}
+
+uint8_t* put_reg_64(uint8_t* cmd, uint64_t reg, uint64_t value) {
+	*(uint16_t*)cmd = CMD_SET_REG_64;
+	*(uint64_t*)(cmd + 2) = reg;
+	*(uint64_t*)(cmd + 10) = value;
+	return cmd + 18;
+}
+
+// write a CBO binding the target and clearing it to a color that changes
+// every frame, so each readback carries new data
+void write_clear_cbo(uint32_t frame) {
+	uint8_t cbo[256];
+	memset(cbo, 0, sizeof(cbo));
+	uint8_t* cmd = cbo + 4;
+	cmd = put_reg_32(cmd, FB_CFG_REG, 1);
+	cmd = put_reg_64(cmd, COLOR_ATTACH_0_REG, TBO_ADDR);
+	cmd = put_reg_32(cmd, VIEW_SIZE_X_REG, TARGET_W);
+	cmd = put_reg_32(cmd, VIEW_SIZE_Y_REG, TARGET_H);
+
+	float rgba[4] = { (frame % 256) / 255., 0.5, 0.25, 1. };
+	*(uint16_t*)cmd = CMD_CLEAR_ATTACHS;
+	*(uint32_t*)(cmd + 2) = 1;
+	memmove(cmd + 6, rgba, 16);
+	cmd += 27;
+
+	// one byte of padding, decoding stops a byte short of the end
+	*(uint32_t*)cbo = cmd - (cbo + 4) + 1;
+	gpu_write(CBO_ADDR, cbo, cmd - cbo + 1);
+}
+
+uint8_t check_frame(uint32_t frame) {
+	uint8_t* px = ram + DST_ADDR + TARGET_BYTES - 4;
+	return px[0] == frame % 256 && px[3] == 255;
+}
+
+void read_sync() {
+	object_t* tbo = get_object_precise(TBO_ADDR, TYPE_TBO, ANY_LENGTH);
+	flush_object(tbo);
+	memcpy(ram + DST_ADDR, vram + TBO_ADDR + TBO_HEADER_LEN, TARGET_BYTES);
+}
+
+// returns the time start_dma() held the calling thread
+uint64_t read_async() {
+	uint32_t* status = (uint32_t*)(ram + DESC_ADDR + DMA_DESC_STATUS);
+	*status = DMA_STATUS_PENDING;
+
+	uint64_t start = now_ns();
+	start_dma(DST_ADDR, TBO_ADDR + TBO_HEADER_LEN, TARGET_BYTES, 0, DESC_ADDR);
+	uint64_t issue_ns = now_ns() - start;
+
+	while(__atomic_load_n(status, __ATOMIC_ACQUIRE) != DMA_STATUS_DONE)
+		retire_readbacks();
+	return issue_ns;
+}
+
+int main(int argc, char** argv) {
+	uint32_t n_frames = argc > 1 ? atoi(argv[1]) : DEFAULT_FRAMES;
+
+	if(!glfwInit())
+		ERROR("failed to initialize glfw\n");
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	window = glfwCreateWindow(1, 1, "", NULL, NULL);
+	if(!window)
+		ERROR("failed to create window\n");
+	glfwMakeContextCurrent(window);
+	init_fences(0);
+
+	uint8_t header[TBO_HEADER_LEN];
+	*(uint16_t*)header = (2 << 13) | FORMAT_RGBA_8;
+	uint32_t dims[3] = { TARGET_W, TARGET_H, 1 };
+	memcpy(header + 2, dims, 12);
+	gpu_write(TBO_ADDR, header, TBO_HEADER_LEN);
+
+	uint64_t sync_ns = 0, async_ns = 0, issue_ns = 0;
+	uint32_t bad_frames = 0;
+
+	for(uint32_t i = 0; i < n_frames; i++) {
+		write_clear_cbo(i);
+		uint64_t start = now_ns();
+		dispatch_cmd_buffer(CBO_ADDR, 0);
+		read_sync();
+		sync_ns += now_ns() - start;
+		bad_frames += !check_frame(i);
+	}
+
+	reset_readback_stats();
+	for(uint32_t i = 0; i < n_frames; i++) {
+		write_clear_cbo(i);
+		uint64_t start = now_ns();
+		dispatch_cmd_buffer(CBO_ADDR, 0);
+		issue_ns += read_async();
+		async_ns += now_ns() - start;
+		bad_frames += !check_frame(i);
+	}
+
+	readback_stats_t* r = get_readback_stats();
+	printf("%u frames of %ux%u RGBA (%.1f MB)\n", n_frames, TARGET_W, TARGET_H,
+		TARGET_BYTES / 1e6);
+	printf("sync flush:      %.3f ms/frame\n", sync_ns / 1e6 / n_frames);
+	printf("async readback:  %.3f ms/frame, %.3f ms blocking in start_dma\n",
+		async_ns / 1e6 / n_frames, issue_ns / 1e6 / n_frames);
+	printf("readbacks: %llu async, %llu landed, %llu us average latency\n",
+		(unsigned long long)r->async, (unsigned long long)r->landed,
+		(unsigned long long)(r->landed ? r->latency_ns / r->landed / 1000 : 0));
+	if(bad_frames)
+		printf("%u frames read back the wrong color\n", bad_frames);
+
+	glfwTerminate();
+	return bad_frames > 0;
+}
@@ -0,0 +1,106 @@
+// region query microbenchmark: counts the objects overlapping each of 10k+
+// live objects, with the interval tree behind query_region() and with the
+// bucket scan it replaced, and checks both agree. no GL context is created.
+//
+// build from this directory, linking the GPU sources except main.c:
+//   cc -O2 -I.. -o region_bench region_bench.c
+//       $(ls ../*.c | grep -v main.c) -lGL -lglfw -lm -lpthread
+//   ./region_bench [n_objects]
+#include "../../../defs.h"
+
+#define DEFAULT_OBJECTS	10000
+#define LARGE_LEN		0x100000	/* every 10th object is 1 MB */
+#define MAX_SMALL_LEN	0x10000
+
+uint8_t ram[RAM_CAPACITY];
+
+GLFWwindow* get_window()				{ return 0; }
+uint8_t* get_ram()						{ return ram; }
+void page_flip_irq()					{}
+void dma_read_complete_irq()			{}
+void dma_write_complete_irq()			{}
+void fence_irq()						{}
+void gpu_flip(uint64_t a, uint8_t v)	{}
+void gpu_batch()						{}
+
+uint8_t atomic_get_u8(uint8_t* var)				{ return *var; }
+uint64_t atomic_get_u64(uint64_t* var)			{ return *var; }
+void atomic_set_u8(uint8_t* var, uint8_t val)	{ *var = val; }
+void atomic_set_u64(uint64_t* var, uint64_t val)	{ *var = val; }
+
+// the replaced index: each object is listed in every bucket it spans, and
+// queries dedupe hits with a realloc'd seen list
+objvec_t scan_buckets[VRAM_CAPACITY / BO_BUCKET_SIZE];
+
+void scan_add(object_t* obj) {
+	uint64_t end = obj->addr + obj->len - 1;
+	for(uint64_t b = obj->addr / BO_BUCKET_SIZE; b <= end / BO_BUCKET_SIZE; b++)
+		objvec_push(&scan_buckets[b], obj);
+}
+
+uint32_t scan_count(uint64_t addr, uint64_t len) {
+	object_t** seen_list = 0;
+	uint32_t count = 0;
+
+	uint64_t end = addr + len - 1;
+	for(uint64_t b = addr / BO_BUCKET_SIZE; b <= end / BO_BUCKET_SIZE; b++) {
+		objvec_t* bucket = &scan_buckets[b];
+		for(uint32_t i = 0; i < bucket->count; i++) {
+			object_t* obj = OBJVEC_DATA(bucket)[i];
+
+			uint8_t seen = 0;
+			for(uint32_t j = 0; j < count && !seen; j++)
+				seen = seen_list[j] == obj;
+
+			if(!seen && check_overlap(obj->addr, obj->addr + obj->len - 1, addr, end)) {
+				seen_list = realloc(seen_list, sizeof(object_t*) * (count + 1));
+				seen_list[count++] = obj;
+			}
+		}
+	}
+
+	free(seen_list);
+	return count;
+}
+
+int main(int argc, char** argv) {
+	uint32_t n_objects = argc > 1 ? atoi(argv[1]) : DEFAULT_OBJECTS;
+	object_t** objs = malloc(sizeof(object_t*) * n_objects);
+	uint32_t* counts = malloc(sizeof(uint32_t) * n_objects);
+	srand(1);
+
+	for(uint32_t i = 0; i < n_objects; i++) {
+		uint64_t len = i % 10 == 0 ? LARGE_LEN : 256 + rand() % MAX_SMALL_LEN;
+		uint64_t addr = ((uint64_t)rand() * 256) % (VRAM_CAPACITY - LARGE_LEN);
+
+		object_t* obj = alloc_object();
+		obj->addr = addr;
+		obj->len = len;
+		obj->type = TYPE_CBO;
+		add_to_bucket(obj);
+		scan_add(obj);
+		objs[i] = obj;
+	}
+
+	uint64_t start = now_ns();
+	for(uint32_t i = 0; i < n_objects; i++)
+		counts[i] = scan_count(objs[i]->addr, objs[i]->len);
+	uint64_t scan_ns = now_ns() - start;
+
+	start = now_ns();
+	uint64_t total = 0;
+	for(uint32_t i = 0; i < n_objects; i++) {
+		uint32_t count = count_region(objs[i]->addr, objs[i]->len);
+		if(count != counts[i]) {
+			printf("mismatch at object %u: tree %u, scan %u\n", i, count, counts[i]);
+			return 1;
+		}
+		total += count;
+	}
+	uint64_t tree_ns = now_ns() - start;
+
+	printf("%u objects, %llu overlaps\n", n_objects, (unsigned long long)total);
+	printf("bucket scan:   %.4f s\n", scan_ns / (double)NS_PER_SEC);
+	printf("interval tree: %.4f s\n", tree_ns / (double)NS_PER_SEC);
+	return 0;
+}
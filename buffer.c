@@ -1,182 +1,74 @@
 #include "../../defs.h"
 
-bucket_t bo_bucket[VRAM_CAPACITY / BO_BUCKET_SIZE];
+objvec_t bo_bucket[VRAM_CAPACITY / BO_BUCKET_SIZE];
+itree_node_t* bo_tree;
 
-object_t** obj_overlaps_list;
-uint32_t obj_overlaps_count;
+objvec_t dirty_objs;		// objects with writes not yet uploaded to GL
+
+hdr_cache_entry_t hdr_cache[HDR_CACHE_SIZE];
+
+objvec_t bound_objs[NUM_BIND_GROUPS];
 
 int64_t ref_counter = 0;
+uint64_t object_generation;		// see objects_changed()
 
 uint8_t check_overlap(uint64_t x1, uint64_t x2, uint64_t y1, uint64_t y2) {
 	return x2 >= y1 && y2 >= x1;
 }
 
-// get number of objects whose buffers overlap with the region
-uint32_t get_region_object_count(uint64_t addr, uint64_t len) {
-	object_t** seen_list = 0;
-	uint32_t count = 0;
-
-	uint32_t start_bucket = addr / BO_BUCKET_SIZE;
-	uint32_t end_bucket = (addr + len - 1) / BO_BUCKET_SIZE;
-	uint32_t n_buckets = end_bucket - start_bucket + 1;
-	for(uint32_t b = addr / BO_BUCKET_SIZE; n_buckets--; b++) {
-		bucket_t* bucket = &bo_bucket[b];
-		for(uint32_t i = 0; i < bucket->count; i++) {
-			object_t* obj = bucket->objs[i];
-
-			uint8_t seen = 0;
-			for(uint32_t j = 0; j < count && !seen; j++)
-				if(seen_list[j] == obj)
-					seen = 1;
-
-			uint64_t x1 = obj->addr, x2 = obj->addr + obj->len - 1;
-			uint64_t y1 = addr, y2 = addr + len - 1;
-
-			if(!seen && check_overlap(x1, x2, y1, y2)) {
-				seen_list = realloc(seen_list, sizeof(object_t*) * (count + 1));
-				seen_list[count] = obj;
-				count++;
-			}
-		}
+void add_region_hit(itree_node_t* node, void* arg) {
+	region_query_t* q = arg;
+	object_t* obj = node->data;
+
+	if(q->count == q->capacity) {
+		q->capacity *= 2;
+		if(q->hits == q->inline_hits) {
+			q->hits = malloc(sizeof(region_hit_t) * q->capacity);
+			memcpy(q->hits, q->inline_hits, sizeof(q->inline_hits));
+		} else
+			q->hits = realloc(q->hits, sizeof(region_hit_t) * q->capacity);
 	}
 
-	if(seen_list)
-		free(seen_list);
-	return count;
+	q->hits[q->count].obj = obj;
+	q->hits[q->count].refcount = obj->refcount;
+	q->count++;
 }
 
-// get objects whose buffers overlap with the region
-object_t* get_region_object_list(uint32_t match_idx, uint64_t addr, uint64_t len) {
-	object_t** seen_list = 0;
-	uint32_t count = 0;
-	uint32_t obj_idx = 0;
-
-	uint32_t start_bucket = addr / BO_BUCKET_SIZE;
-	uint32_t end_bucket = (addr + len - 1) / BO_BUCKET_SIZE;
-	uint32_t n_buckets = end_bucket - start_bucket + 1;
-	for(uint32_t b = addr / BO_BUCKET_SIZE; n_buckets--; b++) {
-		bucket_t* bucket = &bo_bucket[b];
-		for(uint32_t i = 0; i < bucket->count; i++) {
-			object_t* obj = bucket->objs[i];
-
-			uint8_t seen = 0;
-			for(uint32_t j = 0; j < count && !seen; j++)
-				if(seen_list[j] == obj)
-					seen = 1;
-
-			uint64_t x1 = obj->addr, x2 = obj->addr + obj->len - 1;
-			uint64_t y1 = addr, y2 = addr + len - 1;
-
-			if(!seen && check_overlap(x1, x2, y1, y2)) {
-				seen_list = realloc(seen_list, sizeof(object_t*) * (count + 1));
-				seen_list[count] = obj;
-				if(obj_idx == match_idx) {
-					if(seen_list)
-						free(seen_list);
-					return bucket->objs[i];
-				}
-				count++;
-				obj_idx++;
-			}
-		}
-	}
-
-	if(seen_list)
-		free(seen_list);
-	return 0;
-}
-
-void add_to_bucket(object_t* obj) {
-	uint32_t start_bucket = obj->addr / BO_BUCKET_SIZE;
-	uint32_t end_bucket = (obj->addr + obj->len - 1) / BO_BUCKET_SIZE;
-	uint32_t n_buckets = end_bucket - start_bucket + 1;
-	for(uint32_t b = obj->addr / BO_BUCKET_SIZE; n_buckets--; b++) {
-		bucket_t* bucket = &bo_bucket[b];
-
-		bucket->objs = realloc(bucket->objs,
-			sizeof(object_t*) * (bucket->count + 1));
-		bucket->objs[bucket->count] = obj;
-		bucket->count++;
-	}
+// get objects whose buffers overlap with the region in a single pass
+uint32_t query_region(region_query_t* q, uint64_t addr, uint64_t len) {
+	q->count = 0;
+	q->capacity = REGION_QUERY_INLINE;
+	q->hits = q->inline_hits;
+	itree_query(bo_tree, addr, addr + len - 1, add_region_hit, q);
+	return q->count;
 }
 
-void remove_from_bucket(object_t* obj) {
-	uint32_t start_bucket = obj->addr / BO_BUCKET_SIZE;
-	uint32_t end_bucket = (obj->addr + obj->len - 1) / BO_BUCKET_SIZE;
-	uint32_t n_buckets = end_bucket - start_bucket + 1;
-	for(uint32_t b = obj->addr / BO_BUCKET_SIZE; n_buckets--; b++) {
-		bucket_t* bucket = &bo_bucket[b];
-
-		if(bucket->count == 1) {
-			free(bucket->objs);
-			bucket->objs = (void*)0;
-			bucket->count = 0;
-			continue;
-		}
-
-		for(uint32_t i = 0; i < bucket->count; i++)
-			if(bucket->objs[i] == obj) {
-				if(i < bucket->count - 1)
-					bucket->objs[i] = bucket->objs[bucket->count - 1];
-
-				bucket->objs = realloc(bucket->objs,
-					sizeof(object_t*) * (bucket->count - 1));
-				bucket->count--;
-				break;
-			}
-	}
+// get number of objects overlapping the region without listing them
+uint32_t count_region(uint64_t addr, uint64_t len) {
+	return itree_count(bo_tree, addr, addr + len - 1);
 }
 
-void add_to_overlaps(object_t* obj) {
-	object_t** list = obj_overlaps_list;
-	list = realloc(list, sizeof(object_t*) * (obj_overlaps_count + 1));
-	list[obj_overlaps_count] = obj;
-	obj_overlaps_list = list;
-	obj_overlaps_count++;
+void free_region_query(region_query_t* q) {
+	if(q->hits != q->inline_hits)
+		free(q->hits);
+	q->hits = q->inline_hits;
+	q->count = 0;
 }
 
-void remove_from_overlaps(object_t* obj) {
-	if(!obj->in_overlaps)
-		return;
-
-	if(obj_overlaps_count == 1) {
-		free(obj_overlaps_list);
-		obj_overlaps_list = (void*)0;
-		obj_overlaps_count = 0;
-		obj->in_overlaps = 0;
-		return;
-	}
-
-	for(uint32_t i = 0; i < obj_overlaps_count; i++)
-		if(obj_overlaps_list[i] == obj) {
-			object_t** list = obj_overlaps_list;
-
-			if(i < obj_overlaps_count - 1)
-				list[i] = list[obj_overlaps_count - 1];
-
-			list = realloc(list, sizeof(object_t*) * (obj_overlaps_count - 1));
+// objects are hashed by starting address for exact lookups and indexed by
+// range in bo_tree for region queries
+void add_to_bucket(object_t* obj) {
+	objvec_push(&bo_bucket[obj->addr / BO_BUCKET_SIZE], obj);
 
-			obj_overlaps_list = list;
-			obj_overlaps_count--;
-			obj->in_overlaps = 0;
-			return;
-		}
+	obj->tree_node.start = obj->addr;
+	obj->tree_node.end = obj->addr + obj->len - 1;
+	obj->tree_node.data = obj;
+	itree_insert(&bo_tree, &obj->tree_node);
 }
 
-void mark_all_overlaps(uint64_t addr, uint64_t len) {
-	uint32_t count = get_region_object_count(addr, len);
-	if(count == 1)
-		return;		// no overlaps
-
-	for(uint32_t i = 0; i < count; i++) {
-		object_t* obj = get_region_object_list(i, addr, len);
-		if(obj->in_overlaps)
-			continue;
-
-		add_to_overlaps(obj);
-
-		obj->in_overlaps = 1;
-	}
+void remove_from_bucket(object_t* obj) {
+	itree_remove(&bo_tree, &obj->tree_node);
+	objvec_remove(&bo_bucket[obj->addr / BO_BUCKET_SIZE], obj);
 }
 
 uint32_t get_header_length(uint8_t type) {
@@ -189,10 +81,10 @@ uint32_t get_header_length(uint8_t type) {
 	}
 }
 
-uint64_t get_header_info(header_t* header, uint64_t addr, uint8_t type) {
+uint64_t read_header_info(header_t* header, uint64_t addr, uint8_t type) {
 	uint32_t header_len = get_header_length(type);
 	if(!header_len)
-		ERROR("bad type specified to get_header_info\n");
+		ERROR("bad type specified to read_header_info\n");
 
 	uint8_t* data = malloc(header_len);
 	data = gpu_read(data, addr, header_len);
@@ -252,6 +144,64 @@ uint64_t get_header_info(header_t* header, uint64_t addr, uint8_t type) {
 	return len;
 }
 
+hdr_cache_entry_t* get_hdr_cache_entry(uint64_t addr, uint8_t type) {
+	return &hdr_cache[((addr / 256) * NUM_TYPES + type) % HDR_CACHE_SIZE];
+}
+
+// decoded headers are cached per (address, type) until the header bytes are
+// written; see invalidate_headers()
+uint64_t get_header_info(header_t* header, uint64_t addr, uint8_t type) {
+	hdr_cache_entry_t* entry = get_hdr_cache_entry(addr, type);
+	if(entry->type == type && entry->addr == addr) {
+		*header = entry->header;
+		return entry->len;
+	}
+
+	memset(header, 0, sizeof(header_t));
+	uint64_t len = read_header_info(header, addr, type);
+
+	entry->addr = addr;
+	entry->type = type;
+	entry->header = *header;
+	entry->len = len;
+	return len;
+}
+
+// drop cached headers overlapping a VRAM range that is being written
+void invalidate_headers(uint64_t addr, uint64_t len) {
+	uint64_t first = addr < MAX_HEADER_LEN ? 0 : addr - MAX_HEADER_LEN + 1;
+	first = (first + 255) / 256 * 256;
+	uint64_t last = (addr + len - 1) / 256 * 256;
+	if(first > last)
+		return;
+
+	if((last - first) / 256 >= HDR_CACHE_SIZE) {
+		memset(hdr_cache, 0, sizeof(hdr_cache));
+		return;
+	}
+
+	for(uint64_t a = first; a <= last; a += 256)
+		for(uint8_t type = 1; type <= NUM_TYPES; type++) {
+			uint32_t header_len = get_header_length(type);
+			if(!header_len || a + header_len - 1 < addr)
+				continue;
+
+			hdr_cache_entry_t* entry = get_hdr_cache_entry(a, type);
+			if(entry->type == type && entry->addr == a)
+				entry->type = 0;
+		}
+}
+
+// record that objects were created or freed, or their data in VRAM changed.
+// state built from objects compares generations to know when to rebuild.
+void objects_changed() {
+	object_generation++;
+}
+
+uint64_t get_object_generation() {
+	return object_generation;
+}
+
 object_t* get_object_precise(uint64_t addr, uint8_t type, int64_t len) {
 	if(len <= 0 && len != ANY_LENGTH) {
 		WARN("bad length %lld passed to get_object_precise, must be a "
@@ -262,9 +212,9 @@ object_t* get_object_precise(uint64_t addr, uint8_t type, int64_t len) {
 	if(len > 0 && addr + len >= VRAM_CAPACITY)
 		return 0;
 
-	bucket_t* bucket = &bo_bucket[addr / BO_BUCKET_SIZE];
+	objvec_t* bucket = &bo_bucket[addr / BO_BUCKET_SIZE];
 	for(uint32_t i = 0; i < bucket->count; i++) {
-		object_t* obj = bucket->objs[i];
+		object_t* obj = OBJVEC_DATA(bucket)[i];
 
 		if(obj->addr == addr && obj->type == type
 		&& (len == ANY_LENGTH ? 1 : obj->len == len))
@@ -273,37 +223,63 @@ object_t* get_object_precise(uint64_t addr, uint8_t type, int64_t len) {
 	return 0;
 }
 
-object_t* create_object(header_t* header, uint64_t addr, uint8_t type, uint64_t len) {
-	uint8_t* data = malloc(len);
-	data = gpu_read(data, addr, len);
+// objects bound by the current state are marked used on every draw, as
+// bindings are kept across draws
+void clear_bindings(uint8_t group) {
+	objvec_clear(&bound_objs[group]);
+}
 
-	if(!data) {
-		WARN("error occurred during read for create_object %llx, length %llx\n",
-			addr, len);
-		return 0;
+void add_binding(uint8_t group, object_t* obj) {
+	objvec_push(&bound_objs[group], obj);
+}
+
+void remove_bindings(object_t* obj) {
+	for(uint32_t i = 0; i < NUM_BIND_GROUPS; i++)
+		while(objvec_remove(&bound_objs[i], obj));
+}
+
+void use_bindings(uint8_t group) {
+	for(uint32_t i = 0; i < bound_objs[group].count; i++) {
+		object_t* obj = OBJVEC_DATA(&bound_objs[group])[i];
+		mark_gpu_use(obj);
+
+		// render targets and storage buffers may be written by the GPU
+		if(group == BIND_FBO || obj->type == TYPE_SBO)
+			mark_modified(obj, obj->addr + obj->header_len,
+				obj->len - obj->header_len);
 	}
+}
 
-	object_t* obj = calloc(1, sizeof(object_t));
+object_t* create_object(header_t* header, uint64_t addr, uint8_t type, uint64_t len) {
+	// buffer objects load their data into the shared store
+	uint8_t* data = 0;
+	if(!IS_BUFFER_TYPE(type)) {
+		data = malloc(len);
+		data = gpu_read(data, addr, len);
+
+		if(!data) {
+			WARN("error occurred during read for create_object %llx, length %llx\n",
+				addr, len);
+			return 0;
+		}
+	}
+
+	object_t* obj = alloc_object();
 	obj->addr = addr;
 	obj->len = len;
 	obj->type = type;
 	obj->header_len = get_header_length(type);
 	obj->header = *header;
+	objects_changed();
+	obj->generation = get_object_generation();
+
+	if(IS_BUFFER_TYPE(type))
+		attach_store(obj);
 
 	add_to_bucket(obj);
 
-	mark_all_overlaps(addr, len);
+	mark_all_overlaps(obj);
 
-	if(type == TYPE_VBO) {
-		glGenBuffers(1, &obj->gl_buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, obj->gl_buffer);
-		glBufferData(GL_ARRAY_BUFFER, obj->len, data, GL_STATIC_DRAW);
-	}
-	if(type == TYPE_IBO) {
-		glGenBuffers(1, &obj->gl_buffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->gl_buffer);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj->len, data, GL_STATIC_DRAW);
-	}
 	if(type == TYPE_TBO) {
 		glGenTextures(1, &obj->gl_buffer);
 		glActiveTexture(GL_TEXTURE0);
@@ -312,21 +288,36 @@ object_t* create_object(header_t* header, uint64_t addr, uint8_t type, uint64_t
 	}
 	if(type == TYPE_KERNEL)
 		obj->kernel_info = 0;
-	if(type == TYPE_UBO) {
-		glGenBuffers(1, &obj->gl_buffer);
-		glBindBuffer(GL_UNIFORM_BUFFER, obj->gl_buffer);
-		glBufferData(GL_UNIFORM_BUFFER, obj->len, data, GL_STATIC_DRAW);
-	}
-	if(type == TYPE_SBO) {
-		glGenBuffers(1, &obj->gl_buffer);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, obj->gl_buffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, obj->len, data, GL_STATIC_DRAW);
-	}
 
 	free(data);
 	return obj;
 }
 
+// pending writes of obj, kept by its store if it has one
+rangeset_t* get_dirty(object_t* obj) {
+	return obj->store ? &obj->store->dirty : &obj->dirty;
+}
+
+// objects sharing storage never need copies to stay coherent
+uint8_t same_storage(object_t* a, object_t* b) {
+	return a == b || (a->store && a->store == b->store);
+}
+
+// read from obj's GL-side storage, ignoring pending dirty ranges
+void read_gl_storage(object_t* obj, uint8_t* dst, uint64_t src, uint64_t n) {
+	if(obj->store)
+		read_store(obj->store, dst, src, n);
+	else if(obj->type == TYPE_TBO)
+		read_texture(obj, dst, src, n);
+}
+
+void write_gl_storage(object_t* obj, uint64_t dst, uint8_t* src, uint64_t n) {
+	if(obj->store)
+		write_store(obj->store, dst, src, n);
+	else if(obj->type == TYPE_TBO)
+		write_texture(obj, dst, src, n);
+}
+
 void object_read(object_t* obj, uint8_t* dst, uint64_t src, uint64_t n) {
 	if(src < obj->addr || src + n > obj->addr + obj->len)
 		ERROR("object read [%d,%d] out of bounds\n", src, src + n - 1);
@@ -342,25 +333,42 @@ void object_read(object_t* obj, uint8_t* dst, uint64_t src, uint64_t n) {
 			return;
 	}
 
-	if(obj->type == TYPE_VBO) {
-		glBindBuffer(GL_ARRAY_BUFFER, obj->gl_buffer);
-		glGetBufferSubData(GL_ARRAY_BUFFER, src - obj->addr, n, dst);
-	} else if(obj->type == TYPE_IBO) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->gl_buffer);
-		glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, src - obj->addr, n, dst);
-	} else if(obj->type == TYPE_UBO) {
-		glBindBuffer(GL_UNIFORM_BUFFER, obj->gl_buffer);
-		glGetBufferSubData(GL_UNIFORM_BUFFER, src - obj->addr, n, dst);
-	} else if(obj->type == TYPE_SBO) {
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, obj->gl_buffer);
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, src - obj->addr, n, dst);
-	} else if(obj->type == TYPE_TBO)
-		read_texture(obj, dst, src, n);
-	else
+	if(!HAS_GL_STORAGE(obj->type)) {
 		memmove(dst, vram + src, n);
+		return;
+	}
+
+	// dirty ranges haven't been uploaded yet, their newest data is in VRAM
+	rangeset_t* dirty = get_dirty(obj);
+	for(uint32_t i = 0; i < dirty->count && n; i++) {
+		range_t* r = &dirty->ranges[i];
+		if(r->end < src)
+			continue;
+		if(r->start > src + n - 1)
+			break;
+
+		if(r->start > src) {
+			uint64_t count = r->start - src;
+			read_gl_storage(obj, dst, src, count);
+			dst += count;
+			src += count;
+			n -= count;
+		}
+
+		uint64_t count = r->end - src + 1;
+		count = count > n ? n : count;
+		memmove(dst, vram + src, count);
+		dst += count;
+		src += count;
+		n -= count;
+	}
+
+	if(n)
+		read_gl_storage(obj, dst, src, n);
 }
 
+// record a write for upload by flush_dirty(); the data must already be in VRAM.
+// persistently mapped objects are written immediately instead.
 void object_write(object_t* obj, uint64_t dst, uint8_t* src, uint64_t n) {
 	if(dst < obj->addr || dst + n > obj->addr + obj->len)
 		ERROR("object write [%d,%d] out of bounds\n", dst, dst + n - 1);
@@ -377,20 +385,46 @@ void object_write(object_t* obj, uint64_t dst, uint8_t* src, uint64_t n) {
 			return;
 	}
 
-	if(obj->type == TYPE_VBO) {
-		glBindBuffer(GL_ARRAY_BUFFER, obj->gl_buffer);
-		glBufferSubData(GL_ARRAY_BUFFER, dst - obj->addr, n, src);
-	} else if(obj->type == TYPE_IBO) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->gl_buffer);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, dst - obj->addr, n, src);
-	} else if(obj->type == TYPE_UBO) {
-		glBindBuffer(GL_UNIFORM_BUFFER, obj->gl_buffer);
-		glBufferSubData(GL_UNIFORM_BUFFER, dst - obj->addr, n, src);
-	} else if(obj->type == TYPE_SBO) {
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, obj->gl_buffer);
-		glBufferSubData(GL_SHADER_STORAGE_BUFFER, dst - obj->addr, n, src);
-	} else if(obj->type == TYPE_TBO)
-		write_texture(obj, dst, src, n);
+	if(!HAS_GL_STORAGE(obj->type))
+		return;
+
+	if(obj->store) {
+		if(obj->store->gl_map)		// mapped storage is written in place
+			write_store(obj->store, dst, src, n);
+		else
+			mark_store_dirty(obj->store, dst, n);
+		return;
+	}
+
+	if(!obj->dirty.count)
+		objvec_push(&dirty_objs, obj);
+	rangeset_add(&obj->dirty, dst, dst + n - 1);
+}
+
+// upload pending writes to the object's GL storage, one call per merged range
+void flush_dirty(object_t* obj) {
+	if(obj->store) {
+		flush_store(obj->store);
+		return;
+	}
+
+	rangeset_t* dirty = &obj->dirty;
+	if(!dirty->count)
+		return;
+
+	for(uint32_t i = 0; i < dirty->count; i++) {
+		range_t* r = &dirty->ranges[i];
+		write_gl_storage(obj, r->start, vram + r->start, r->end - r->start + 1);
+	}
+
+	rangeset_clear(dirty);
+	objvec_remove(&dirty_objs, obj);
+}
+
+void flush_all_dirty() {
+	while(dirty_objs.count)
+		flush_dirty(OBJVEC_DATA(&dirty_objs)[0]);
+	flush_all_stores();
 }
 
 // flush object's data to VRAM
@@ -398,8 +432,11 @@ void flush_object(object_t* obj) {
 	uint8_t* data = malloc(obj->len);
 
 	if(!obj->in_overlaps) {		// optimal case: no overlaps
+		// the object already holds this data, only VRAM needs it
 		object_read(obj, data, obj->addr, obj->len);
-		gpu_write(obj->addr, data, obj->len);
+		land_readbacks(obj->addr, obj->len);
+		memmove(vram + obj->addr, data, obj->len);
+		vram_written(obj->addr, obj->len);
 	} else {
 		// the preferred refcount age for overlapping objects is swapped here.
 		// we read newest (latest writes - prioritize objects referenced this
@@ -411,51 +448,28 @@ void flush_object(object_t* obj) {
 	free(data);
 }
 
-void flush_all_overlaps() {
-	// writes directly to VRAM, skips object updating - they'll be freed anyway
-	for(uint32_t i = 0; i < obj_overlaps_count; i++) {
-		object_t* obj = obj_overlaps_list[i];
-		uint8_t* data = malloc(obj->len);
-
-		gpu_read_newest(data, obj->addr, obj->len);
-		memmove(vram + obj->addr, data, obj->len);
-		free(data);
-	}
-}
-
 void free_object(object_t* obj) {
+	objects_changed();
 	remove_from_bucket(obj);
-	remove_from_overlaps(obj);
+	remove_bindings(obj);
+	forget_modified(obj);
 
-	if(obj->in_overlaps) {
-		uint32_t count = get_region_object_count(obj->addr, obj->len);
+	if(obj->dirty.count)
+		objvec_remove(&dirty_objs, obj);
+	rangeset_free(&obj->dirty);
 
-		// recalc overlaps list for this object's range
-		for(uint32_t i = 0; i < count; i++) {
-			object_t* object = get_region_object_list(i, obj->addr, obj->len);
-			remove_from_overlaps(object);
-		}
-		mark_all_overlaps(obj->addr, obj->len);
-	}
+	if(obj->in_overlaps)	// aliases may no longer overlap anything
+		update_overlaps(obj->addr, obj->len);
 
-	if(obj->type == TYPE_VBO || obj->type == TYPE_IBO || obj->type == TYPE_UBO
-	|| obj->type == TYPE_SBO)
-		glDeleteBuffers(1, &obj->gl_buffer);
-	if(obj->type == TYPE_TBO)
+	if(obj->store)
+		detach_store(obj);
+	if(obj->type == TYPE_TBO) {
+		forget_fbos(obj);
 		glDeleteTextures(1, &obj->gl_buffer);
-	if(obj->type == TYPE_VBO && obj->gl_vao) {
-		glDeleteVertexArrays(1, &obj->gl_vao);
-		free(obj->gl_va_cfgs);
 	}
 	if(obj->type == TYPE_KERNEL)
 		free_kernel(obj);
-	free(obj);
-}
-
-void destroy_all_overlaps() {
-	flush_all_overlaps();
-	for(uint32_t i = 0; i < obj_overlaps_count; i++)
-		free_object(obj_overlaps_list[i]);
+	release_object(obj);
 }
 
 object_t* ref_buffer_precise(uint64_t addr, uint8_t type, int64_t len) {
@@ -4,6 +4,13 @@
 #include "../../defs.h"
 
 #define BO_BUCKET_SIZE 4096
+#define HDR_CACHE_SIZE 4096		/* entries in the decoded header cache */
+#define MAX_HEADER_LEN 14
+
+#define BIND_DTABLES	0
+#define BIND_FBO		1
+#define NUM_BIND_GROUPS	2
+
 #define LENGTH_IN_BUFFER -1
 #define ANY_LENGTH -2
 
@@ -17,6 +24,10 @@
 #define TYPE_UBO		7
 #define TYPE_SBO		8
 #define IS_VALID_TYPE(x) (x != 0 && x <= NUM_TYPES)
+#define IS_BUFFER_TYPE(x) (x == TYPE_VBO || x == TYPE_IBO || x == TYPE_UBO \
+	|| x == TYPE_SBO)
+#define HAS_GL_STORAGE(x) (x == TYPE_VBO || x == TYPE_IBO || x == TYPE_TBO \
+	|| x == TYPE_UBO || x == TYPE_SBO)
 
 // internal copy of object header info
 typedef struct header_t {
@@ -33,39 +44,79 @@ typedef struct header_t {
 	uint64_t kernel_len;
 } header_t;
 
+typedef struct hdr_cache_entry_t {
+	uint64_t addr;
+	uint8_t type;			// 0 if the entry is empty
+	uint64_t len;
+	header_t header;
+} hdr_cache_entry_t;
+
 // internal representation of an object
 typedef struct object_t {
 	uint64_t addr;
 	uint64_t len;
 	uint8_t type;
+	uint64_t generation;	// object generation at creation, unique per object
 	header_t header;
+	itree_node_t tree_node;
 	uint32_t header_len;
 
 	uint8_t in_overlaps;
+	uint8_t in_destroy;
 	uint8_t need_update;
 	int64_t refcount;
 
 	GLuint gl_buffer;
+	rangeset_t dirty;		// written ranges not yet uploaded, if no store
+	struct buffer_store_t* store;	// GL buffer shared by buffer-typed objects
+	uint64_t gl_offset;		// of the object in store->gl_buffer
+	rangeset_t modified;	// changed since the last sync_overlaps(), if aliased
 
 	void* kernel_info;
-	GLuint gl_vao;
-	uint32_t* gl_va_cfgs;
+
+	struct object_t* next_free;		// pool free list link
 } object_t;
 
-typedef struct bucket_t {
+#define REGION_QUERY_INLINE 8
+
+typedef struct region_hit_t {
+	object_t* obj;
+	int64_t refcount;		// obj->refcount at the time of the query
+} region_hit_t;
+
+// objects overlapping a region, sorted by address. filled by query_region()
+// and released with free_region_query().
+typedef struct region_query_t {
 	uint32_t count;
-	object_t** objs;
-} bucket_t;
+	uint32_t capacity;
+	region_hit_t* hits;
+	region_hit_t inline_hits[REGION_QUERY_INLINE];
+} region_query_t;
 
 uint8_t check_overlap(uint64_t x1, uint64_t x2, uint64_t y1, uint64_t y2);
-uint32_t get_region_object_count(uint64_t addr, uint64_t len);
-object_t* get_region_object_list(uint32_t match_idx, uint64_t addr, uint64_t len);
+void add_to_bucket(object_t* obj);
+void remove_from_bucket(object_t* obj);
+uint32_t query_region(region_query_t* q, uint64_t addr, uint64_t len);
+uint32_t count_region(uint64_t addr, uint64_t len);
+void free_region_query(region_query_t* q);
 uint32_t get_header_length(uint8_t type);
+uint64_t get_header_info(header_t* header, uint64_t addr, uint8_t type);
+void invalidate_headers(uint64_t addr, uint64_t len);
 void object_read(object_t* obj, uint8_t* dst, uint64_t src, uint64_t n);
 void object_write(object_t* obj, uint64_t dst, uint8_t* src, uint64_t n);
+rangeset_t* get_dirty(object_t* obj);
+uint8_t same_storage(object_t* a, object_t* b);
+void objects_changed();
+uint64_t get_object_generation();
 object_t* ref_buffer_precise(uint64_t addr, uint8_t type, int64_t len);
 object_t* get_object_precise(uint64_t addr, uint8_t type, int64_t len);
+void clear_bindings(uint8_t group);
+void add_binding(uint8_t group, object_t* obj);
+void remove_bindings(object_t* obj);
+void use_bindings(uint8_t group);
 void flush_object(object_t* obj);
-void destroy_all_overlaps();
+void flush_dirty(object_t* obj);
+void flush_all_dirty();
+void free_object(object_t* obj);
 
 #endif
@@ -0,0 +1,48 @@
+#include "../../defs.h"
+
+cmd_cache_entry_t cmd_cache[CMD_CACHE_SIZE];
+itree_node_t* cmd_cache_tree;
+cmd_cache_stats_t cmd_cache_stats;
+
+// get the decoded commands of a CBO that no other object aliases, decoding
+// them from VRAM only if they changed since last time
+cmd_list_t* get_cached_commands(object_t* cbo) {
+	cmd_cache_entry_t* entry = &cmd_cache[(cbo->addr / 256) % CMD_CACHE_SIZE];
+
+	if(entry->len && entry->addr == cbo->addr && entry->len == cbo->len
+	&& entry->decoded_gen == entry->generation) {
+		cmd_cache_stats.hits++;
+		return &entry->cmds;
+	}
+	cmd_cache_stats.misses++;
+
+	if(entry->addr != cbo->addr || entry->len != cbo->len) {
+		if(entry->len)
+			itree_remove(&cmd_cache_tree, &entry->tree_node);
+
+		entry->addr = cbo->addr;
+		entry->len = cbo->len;
+		entry->tree_node.start = cbo->addr;
+		entry->tree_node.end = cbo->addr + cbo->len - 1;
+		entry->tree_node.data = entry;
+		itree_insert(&cmd_cache_tree, &entry->tree_node);
+	}
+
+	decode_commands(&entry->cmds, vram + cbo->addr + cbo->header_len,
+		cbo->header.n_cmd_bytes);
+	entry->decoded_gen = entry->generation;
+	return &entry->cmds;
+}
+
+void bump_generation(itree_node_t* node, void* arg) {
+	((cmd_cache_entry_t*)node->data)->generation++;
+}
+
+// called on every VRAM write, see vram_written()
+void invalidate_cmd_cache(uint64_t addr, uint64_t len) {
+	itree_query(cmd_cache_tree, addr, addr + len - 1, bump_generation, 0);
+}
+
+cmd_cache_stats_t* get_cmd_cache_stats() {
+	return &cmd_cache_stats;
+}
@@ -0,0 +1,28 @@
+#ifndef CMDCACHE_H
+#define CMDCACHE_H
+
+#include "../../defs.h"
+
+#define CMD_CACHE_SIZE 256		/* command buffers kept decoded */
+
+// decoded commands of a CBO. entries are indexed by range in cmd_cache_tree so
+// VRAM writes can find and bump the generation of every entry they touch.
+typedef struct cmd_cache_entry_t {
+	uint64_t addr;
+	uint64_t len;			// 0 if the entry is empty
+	uint64_t generation;	// bumped by writes to [addr, addr + len - 1]
+	uint64_t decoded_gen;	// generation the commands were decoded at
+	cmd_list_t cmds;
+	itree_node_t tree_node;
+} cmd_cache_entry_t;
+
+typedef struct cmd_cache_stats_t {
+	uint64_t hits;
+	uint64_t misses;
+} cmd_cache_stats_t;
+
+cmd_list_t* get_cached_commands(object_t* cbo);
+void invalidate_cmd_cache(uint64_t addr, uint64_t len);
+cmd_cache_stats_t* get_cmd_cache_stats();
+
+#endif
@@ -5,15 +5,63 @@ uint32_t fbo_dims[2];
 uint32_t fbo_n_color_attachs;
 uint8_t cmd_regs[NUM_BYTES_CMD_REGS];
 
+fbo_cache_entry_t fbo_cache[FBO_CACHE_SIZE];
+GLuint empty_fbo;
+
+vao_cache_entry_t vao_cache[VAO_CACHE_SIZE];
+uint64_t vao_use_counter;
+uint64_t fbo_use_counter;
+
+uint8_t dirty_state;				// STATE_* bits that must be resolved
+uint64_t dtables_generation;		// object generation dtables were bound at
+
 void bind_fbo();
-void bind_vao(object_t* vbo);
+void bind_vao(object_t* vbo, GLuint gl_ibo);
 void gl_set_draw_buffers(uint8_t bmp);
 
-uint32_t exec_cmd(uint16_t op, uint8_t* cmd, uint8_t* end) {
-	// before any command that might access descriptors, need to run
-	// bind_dtables() because it's assumed the dtables that will be accessed are
-	// configured by that point. done again after kernel/dtable address changes.
-	uint8_t need_dtable_bind = 1;
+cmd_list_t decoded_cmds;		// scratch list for uncached command buffers
+
+// draw ranges of the current multi-draw, see exec_draw_run()
+GLint* draw_firsts;
+GLsizei* draw_counts;
+void** draw_offsets;		// IBO offsets of indexed draws
+GLint* draw_base_vertices;
+uint32_t draw_capacity;
+
+GLuint indirect_ibo;		// see draw_indirect()
+uint64_t indirect_ibo_len;
+
+draw_stats_t draw_stats;
+
+void push_op(cmd_list_t* list, cmd_op_t* op) {
+	if(list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 16;
+		list->ops = realloc(list->ops, sizeof(cmd_op_t) * list->capacity);
+	}
+	list->ops[list->count++] = *op;
+}
+
+// register writes are resolved to the state they dirty when decoded
+uint8_t get_reg_effects(uint64_t reg_addr, uint32_t size) {
+	uint64_t x1 = reg_addr, x2 = reg_addr + size - 1;
+	uint8_t effects = 0;
+
+	if(check_overlap(x1, x2, FB_CFG_REG, DEPTH_ATTACH_REG + 7))
+		effects |= STATE_FBO;
+	if(check_overlap(x1, x2, DTBL_0_ADDR_REG, KERNEL_ADDR_REG + 7))
+		effects |= STATE_DTABLES;
+	if(check_overlap(x1, x2, KERNEL_ADDR_REG, KERNEL_ADDR_REG + 7))
+		effects |= STATE_KERNEL;
+	if(check_overlap(x1, x2, UNIFORM_0_REG, UNIFORM_0_REG + 127))
+		effects |= STATE_UNIFORMS;
+	return effects;
+}
+
+// validate one command and append its decoded form to list. returns the
+// number of bytes consumed, 0 if the command is malformed.
+uint32_t decode_cmd(uint16_t op, uint8_t* cmd, uint8_t* end, cmd_list_t* list) {
+	cmd_op_t d;
+	memset(&d, 0, sizeof(cmd_op_t));
 
 	switch(op) {
 		case CMD_SET_REG_32: {
@@ -28,26 +76,12 @@ uint32_t exec_cmd(uint16_t op, uint8_t* cmd, uint8_t* end) {
 				return 14;
 			}
 
-			uint32_t value = *(uint32_t*)(cmd + 10);
-			*(uint32_t*)(cmd_regs + reg_addr) = value;
-
-			uint64_t x1 = reg_addr, x2 = reg_addr + 3;
-			uint64_t y1 = FB_CFG_REG, y2 = DEPTH_ATTACH_REG + 7;
-			if(check_overlap(x1, x2, y1, y2))
-				bind_fbo();
-
-			y1 = DTBL_0_ADDR_REG, y2 = KERNEL_ADDR_REG + 7;
-			if(check_overlap(x1, x2, y1, y2))
-				need_dtable_bind = 1;
-
-			y1 = KERNEL_ADDR_REG, y2 = KERNEL_ADDR_REG + 7;
-			if(check_overlap(x1, x2, y1, y2))
-				bind_kernel();
-
-			y1 = UNIFORM_0_REG, y2 = UNIFORM_0_REG + 127;
-			if(check_overlap(x1, x2, y1, y2))
-				load_uregs();
-
+			d.type = OP_SET_REG;
+			d.set_reg.reg_addr = reg_addr;
+			d.set_reg.size = 4;
+			d.set_reg.value = *(uint32_t*)(cmd + 10);
+			d.set_reg.effects = get_reg_effects(reg_addr, 4);
+			push_op(list, &d);
 			return 14;
 		} case CMD_SET_REG_64: {
 			if(cmd + 18 > end) {
@@ -62,67 +96,344 @@ uint32_t exec_cmd(uint16_t op, uint8_t* cmd, uint8_t* end) {
 
 			}
 
-			uint64_t value = *(uint64_t*)(cmd + 10);
-			*(uint64_t*)(cmd_regs + reg_addr) = value;
-
-			uint64_t x1 = reg_addr, x2 = reg_addr + 7;
-			uint64_t y1 = FB_CFG_REG, y2 = DEPTH_ATTACH_REG + 7;
-			if(check_overlap(x1, x2, y1, y2))
-				bind_fbo();
+			d.type = OP_SET_REG;
+			d.set_reg.reg_addr = reg_addr;
+			d.set_reg.size = 8;
+			d.set_reg.value = *(uint64_t*)(cmd + 10);
+			d.set_reg.effects = get_reg_effects(reg_addr, 8);
+			push_op(list, &d);
+			return 18;
+		} case CMD_DRAW:
+		  case CMD_DRAW_INDEXED:
+		  case CMD_DRAW_INDIRECT:
+		  case CMD_DRAW_INDEXED_INDIRECT: {
+			d.type = OP_DRAW;
+			d.draw.indexed = op == CMD_DRAW_INDEXED || op == CMD_DRAW_INDEXED_INDIRECT;
+			d.draw.indirect = op == CMD_DRAW_INDIRECT || op == CMD_DRAW_INDEXED_INDIRECT;
+			push_op(list, &d);
+			return 2;
+		} case CMD_CLEAR_ATTACHS: {
+			if(cmd + 27 > end) {
+				WARN("clear attachments command out of bounds\n");
+				return 27;
+			}
 
-			y1 = DTBL_0_ADDR_REG, y2 = KERNEL_ADDR_REG + 7;
-			if(check_overlap(x1, x2, y1, y2))
-				need_dtable_bind = 1;
+			d.type = OP_CLEAR;
+			d.clear.bmp = *(uint32_t*)(cmd + 2);
+			memmove(d.clear.rgba, cmd + 6, 16);
+			d.clear.depth = *(uint32_t*)(cmd + 22);
+			d.clear.stencil = *(uint8_t*)(cmd + 26);
+			push_op(list, &d);
+			return 27;
+		} case CMD_COPY_BUFFER: {
+			if(cmd + 26 > end) {
+				WARN("copy buffer command out of bounds\n");
+				return 26;
+			}
 
-			y1 = KERNEL_ADDR_REG, y2 = KERNEL_ADDR_REG + 7;
-			if(check_overlap(x1, x2, y1, y2))
-				bind_kernel();
+			d.type = OP_COPY;
+			d.xfer.src = *(uint64_t*)(cmd + 2);
+			d.xfer.dst = *(uint64_t*)(cmd + 10);
+			d.xfer.len = *(uint64_t*)(cmd + 18);
+			push_op(list, &d);
+			return 26;
+		} case CMD_FILL_BUFFER: {
+			if(cmd + 22 > end) {
+				WARN("fill buffer command out of bounds\n");
+				return 22;
+			}
 
-			y1 = UNIFORM_0_REG, y2 = UNIFORM_0_REG + 127;
-			if(check_overlap(x1, x2, y1, y2))
-				load_uregs();
+			d.type = OP_FILL;
+			d.xfer.dst = *(uint64_t*)(cmd + 2);
+			d.xfer.len = *(uint64_t*)(cmd + 10);
+			d.xfer.value = *(uint32_t*)(cmd + 18);
+			push_op(list, &d);
+			return 22;
+		} case CMD_BLIT_TEXTURE: {
+			if(cmd + 54 > end) {
+				WARN("blit texture command out of bounds\n");
+				return 54;
+			}
 
-			return 18;
-		} case CMD_DRAW: {
-			if(need_dtable_bind) {
-				bind_dtables();
-				need_dtable_bind = 0;
+			d.type = OP_BLIT;
+			d.blit.src = *(uint64_t*)(cmd + 2);
+			d.blit.dst = *(uint64_t*)(cmd + 10);
+			memmove(d.blit.src_rect, cmd + 18, 16);
+			memmove(d.blit.dst_rect, cmd + 34, 16);
+			d.blit.flags = *(uint32_t*)(cmd + 50);
+			push_op(list, &d);
+			return 54;
+		} case CMD_SIGNAL_FENCE:
+		  case CMD_WAIT_SEMAPHORE: {
+			if(cmd + 22 > end) {
+				WARN("%s command out of bounds\n",
+					op == CMD_SIGNAL_FENCE ? "signal fence" : "wait semaphore");
+				return 22;
 			}
 
-			uint64_t vbo_addr	= *(uint64_t*)(cmd_regs + VBO_ADDR_REG);
-			uint64_t vbo_len	= *(uint64_t*)(cmd_regs + VBO_LEN_REG);
-			uint64_t base_idx	= *(uint64_t*)(cmd_regs + BASE_IDX_REG);
-			uint64_t idx_count	= *(uint64_t*)(cmd_regs + IDX_COUNT_REG);
+			d.type = op == CMD_SIGNAL_FENCE ? OP_FENCE : OP_WAIT;
+			d.sync.addr = *(uint64_t*)(cmd + 2);
+			d.sync.value = *(uint64_t*)(cmd + 10);
+			d.sync.flags = *(uint32_t*)(cmd + 18);
+			push_op(list, &d);
+			return 22;
+		} default:
+			return 0;
+	}
+}
 
-			if(vbo_len > VRAM_CAPACITY) {
-				WARN("length for vbo %llx too large, skipping command\n", vbo_addr);
-				return 2;
-			}
+void mark_state_dirty(uint8_t state) {
+	dirty_state |= state;
+}
 
-			object_t* vbo = ref_buffer_precise(vbo_addr, TYPE_VBO, vbo_len);
-			if(!vbo) {
-				WARN("failed to get vbo %llx for draw, skipping command\n", vbo_addr);
-				return 2;
-			}
+// rebuild state whose registers changed since it was last resolved, so a run
+// of register writes costs one rebuild at the next command that uses it
+void validate_state(uint8_t state) {
+	// descriptors reference objects, which may have been recreated, moved to
+	// another store or had their data changed since the last bind
+	if(dtables_generation != get_object_generation())
+		dirty_state |= STATE_DTABLES;
 
-			bind_vao(vbo);
-			glDrawArrays(GL_TRIANGLES, base_idx, idx_count);
-			return 2;
-		} case CMD_CLEAR_ATTACHS: {
-			if(cmd + 27 > end) {
-				WARN("clear attachments command out of bounds\n");
-				return 27;
+	uint8_t todo = dirty_state & state;
+	dirty_state &= ~state;
+
+	if(todo & STATE_FBO)
+		bind_fbo();
+	if(todo & STATE_KERNEL)
+		bind_kernel();		// also loads uniforms
+	else if(todo & STATE_UNIFORMS)
+		load_uregs();
+
+	// before any command that might access descriptors, need to run
+	// bind_dtables() because it's assumed the dtables that will be accessed are
+	// configured by that point. done again after kernel/dtable address changes.
+	if(todo & STATE_DTABLES) {
+		bind_dtables();
+		dtables_generation = get_object_generation();
+	}
+}
+
+GLenum get_gl_topology(uint8_t topology) {
+	switch(topology) {
+		case TOPOLOGY_TRIANGLES:		return GL_TRIANGLES;
+		case TOPOLOGY_TRIANGLE_STRIP:	return GL_TRIANGLE_STRIP;
+		case TOPOLOGY_TRIANGLE_FAN:		return GL_TRIANGLE_FAN;
+		case TOPOLOGY_LINES:			return GL_LINES;
+		case TOPOLOGY_LINE_STRIP:		return GL_LINE_STRIP;
+		default:						return GL_POINTS;
+	}
+}
+
+// reference the buffers used by a draw, 0 if it must be skipped. the caller
+// references any other buffers it needs before validate_state(), as creating
+// one may move a descriptor's object into a merged store and free its buffer.
+uint8_t begin_draw(draw_state_t* s, uint8_t indexed) {
+	memset(s, 0, sizeof(draw_state_t));
+
+	uint64_t vbo_addr	= *(uint64_t*)(cmd_regs + VBO_ADDR_REG);
+	uint64_t vbo_len	= *(uint64_t*)(cmd_regs + VBO_LEN_REG);
+	uint32_t draw_cfg	= *(uint32_t*)(cmd_regs + DRAW_CFG_REG);
+	s->n_instances		= *(uint32_t*)(cmd_regs + INSTANCE_COUNT_REG);
+	s->base_instance	= *(uint32_t*)(cmd_regs + BASE_INSTANCE_REG);
+	s->base_vertex		= *(int32_t*)(cmd_regs + BASE_VERTEX_REG);
+
+	if(!IS_VALID_TOPOLOGY(GET_TOPOLOGY(draw_cfg))) {
+		WARN("invalid primitive topology %d, skipping command\n",
+			GET_TOPOLOGY(draw_cfg));
+		return 0;
+	}
+	s->mode = get_gl_topology(GET_TOPOLOGY(draw_cfg));
+	s->n_instances = s->n_instances ? s->n_instances : 1;
+
+	if(vbo_len > VRAM_CAPACITY) {
+		WARN("length for vbo %llx too large, skipping command\n", vbo_addr);
+		return 0;
+	}
+
+	s->vbo = ref_buffer_precise(vbo_addr, TYPE_VBO, vbo_len);
+	if(!s->vbo) {
+		WARN("failed to get vbo %llx for draw, skipping command\n", vbo_addr);
+		return 0;
+	}
+
+	if(!indexed)
+		return 1;
+
+	uint64_t ibo_addr	= *(uint64_t*)(cmd_regs + IBO_ADDR_REG);
+	uint64_t ibo_len	= *(uint64_t*)(cmd_regs + IBO_LEN_REG);
+	uint8_t index_type	= GET_INDEX_TYPE(draw_cfg);
+
+	if(!IS_VALID_INDEX_TYPE(index_type)) {
+		WARN("invalid index type %d, skipping command\n", index_type);
+		return 0;
+	}
+	s->index_size = 1 << index_type;
+	s->index_type = s->index_size == 1 ? GL_UNSIGNED_BYTE
+		: s->index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if(ibo_len > VRAM_CAPACITY) {
+		WARN("length for ibo %llx too large, skipping command\n", ibo_addr);
+		return 0;
+	}
+
+	s->ibo = ref_buffer_precise(ibo_addr, TYPE_IBO, ibo_len);
+	if(!s->ibo) {
+		WARN("failed to get ibo %llx for draw, skipping command\n", ibo_addr);
+		return 0;
+	}
+	return 1;
+}
+
+void bind_draw(draw_state_t* s) {
+	bind_vao(s->vbo, s->ibo ? (s->gl_ibo ? s->gl_ibo : s->ibo->gl_buffer) : 0);
+	mark_gpu_use(s->vbo);
+	if(s->ibo)
+		mark_gpu_use(s->ibo);
+	use_bindings(BIND_DTABLES);
+	use_bindings(BIND_FBO);
+	flush_all_dirty();
+}
+
+// issue n draws sharing the current pipeline state as one GL call. for indexed
+// draws, firsts are the first index of each draw in the IBO.
+void draw(GLint* firsts, GLsizei* counts, uint32_t n, uint8_t indexed) {
+	draw_state_t s;
+	if(!begin_draw(&s, indexed))
+		return;
+	validate_state(STATE_ALL);
+
+	for(uint32_t i = 0; i < n && indexed; i++)
+		if(firsts[i] < 0 || counts[i] < 0 || ((uint64_t)firsts[i]
+		+ counts[i]) * s.index_size > s.ibo->len) {
+			WARN("indices of draw exceed ibo %llx, skipping command\n", s.ibo->addr);
+			return;
+		}
+
+	bind_draw(&s);
+
+	// instanced draws and draws from a base instance are never merged
+	if(!indexed) {
+		if(n == 1)
+			glDrawArraysInstancedBaseInstance(s.mode, firsts[0], counts[0],
+				s.n_instances, s.base_instance);
+		else
+			glMultiDrawArrays(s.mode, firsts, counts, n);
+	} else {
+		uint64_t base = s.ibo->gl_offset;
+		if(n == 1)
+			glDrawElementsInstancedBaseVertexBaseInstance(s.mode, counts[0],
+				s.index_type, (void*)(base + (uint64_t)firsts[0] * s.index_size),
+				s.n_instances, s.base_vertex, s.base_instance);
+		else {
+			for(uint32_t i = 0; i < n; i++) {
+				draw_offsets[i] = (void*)(base + (uint64_t)firsts[i] * s.index_size);
+				draw_base_vertices[i] = s.base_vertex;
 			}
+			glMultiDrawElementsBaseVertex(s.mode, counts, s.index_type,
+				(const void* const*)draw_offsets, n, draw_base_vertices);
+		}
+	}
+
+	draw_stats.draws += n;
+	draw_stats.gl_draw_calls++;
+}
 
-			uint32_t bmp = *(uint32_t*)(cmd + 2);
-			float rgba[4];
-			memmove(rgba, cmd + 6, 16);
-			float depth = *(uint32_t*)(cmd + 22);
-			uint8_t stencil = *(uint8_t*)(cmd + 26);
+// draw with parameters read by the GPU from an SBO, as written by a kernel.
+// the records use the GL indirect command layouts.
+void draw_indirect(uint8_t indexed) {
+	draw_state_t s;
+	if(!begin_draw(&s, indexed))
+		return;
+
+	uint64_t sbo_addr	= *(uint64_t*)(cmd_regs + INDIRECT_ADDR_REG);
+	uint64_t sbo_len	= *(uint64_t*)(cmd_regs + INDIRECT_LEN_REG);
+	uint32_t n_draws	= *(uint32_t*)(cmd_regs + INDIRECT_COUNT_REG);
+	uint32_t record_size = indexed ? INDIRECT_INDEXED_DRAW_SIZE : INDIRECT_DRAW_SIZE;
+
+	if(!n_draws)
+		return;
+
+	if(sbo_len > VRAM_CAPACITY) {
+		WARN("length for indirect sbo %llx too large, skipping command\n", sbo_addr);
+		return;
+	}
+
+	object_t* sbo = ref_buffer_precise(sbo_addr, TYPE_SBO, sbo_len);
+	if(!sbo) {
+		WARN("failed to get indirect sbo %llx for draw, skipping command\n", sbo_addr);
+		return;
+	}
+
+	if((uint64_t)n_draws * record_size > sbo->len) {
+		WARN("%d indirect draws exceed sbo %llx, skipping command\n", n_draws, sbo_addr);
+		return;
+	}
+	validate_state(STATE_ALL);
+
+	// indirect first indices count from the start of the element buffer, so
+	// an IBO inside a larger store is copied to the start of a scratch buffer
+	if(indexed && s.ibo->gl_offset) {
+		if(!indirect_ibo)
+			glGenBuffers(1, &indirect_ibo);
+		s.gl_ibo = indirect_ibo;
+	}
+
+	bind_draw(&s);
+	mark_gpu_use(sbo);
+
+	if(s.gl_ibo) {
+		glBindBuffer(GL_COPY_READ_BUFFER, s.ibo->gl_buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, indirect_ibo);
+		if(s.ibo->len > indirect_ibo_len) {
+			glBufferData(GL_COPY_WRITE_BUFFER, s.ibo->len, 0, GL_DYNAMIC_COPY);
+			indirect_ibo_len = s.ibo->len;
+		}
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+			s.ibo->gl_offset, 0, s.ibo->len);
+	}
+
+	// arguments may have been written by shaders
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sbo->gl_buffer);
+	void* offset = (void*)sbo->gl_offset;
+	if(!indexed)
+		glMultiDrawArraysIndirect(s.mode, offset, n_draws, 0);
+	else
+		glMultiDrawElementsIndirect(s.mode, s.index_type, offset, n_draws, 0);
+
+	draw_stats.draws += n_draws;
+	draw_stats.gl_draw_calls++;
+}
+
+void exec_op(cmd_op_t* d) {
+	switch(d->type) {
+		case OP_SET_REG: {
+			uint64_t reg_addr = d->set_reg.reg_addr;
+			if(d->set_reg.size == 4)
+				*(uint32_t*)(cmd_regs + reg_addr) = d->set_reg.value;
+			else
+				*(uint64_t*)(cmd_regs + reg_addr) = d->set_reg.value;
+
+			dirty_state |= d->set_reg.effects;
+			break;
+		} case OP_DRAW: {
+			GLint first = *(uint64_t*)(cmd_regs + BASE_IDX_REG);
+			GLsizei count = *(uint64_t*)(cmd_regs + IDX_COUNT_REG);
+			if(d->draw.indirect)
+				draw_indirect(d->draw.indexed);
+			else
+				draw(&first, &count, 1, d->draw.indexed);
+			break;
+		} case OP_CLEAR: {
+			validate_state(STATE_FBO);
+
+			uint32_t bmp = d->clear.bmp;
+			float* rgba = d->clear.rgba;
 
 			glClearColor(rgba[0], rgba[1], rgba[2], rgba[3]);
-			glClearDepth(depth);
-			glClearStencil(stencil);
+			glClearDepth(d->clear.depth);
+			glClearStencil(d->clear.stencil);
 
 			uint32_t fbo_color_attachs_bmp = (1 << fbo_n_color_attachs) - 1;
 			uint32_t clr_color_bmp = bmp & fbo_color_attachs_bmp;
@@ -131,18 +442,34 @@ uint32_t exec_cmd(uint16_t op, uint8_t* cmd, uint8_t* end) {
 			GLbitfield mask = clr_color_bmp ? GL_COLOR_BUFFER_BIT : 0;
 			if((bmp & CLEAR_DEPTH_ATTACH_BIT) > 0) mask |= GL_DEPTH_BUFFER_BIT;
 			if((bmp & CLEAR_STENCIL_ATTACH_BIT) > 0) mask |= GL_STENCIL_BUFFER_BIT;
+			use_bindings(BIND_FBO);
+			flush_all_dirty();
 			glClear(mask);
 
 			gl_set_draw_buffers(fbo_color_attachs_bmp);
-			return 27;
-		} default:
-			return 0;
+			break;
+		} case OP_COPY: {
+			copy_buffer(d->xfer.dst, d->xfer.src, d->xfer.len);
+			break;
+		} case OP_FILL: {
+			fill_buffer(d->xfer.dst, d->xfer.len, d->xfer.value);
+			break;
+		} case OP_BLIT: {
+			blit_texture(d->blit.dst, d->blit.src, d->blit.dst_rect,
+				d->blit.src_rect, d->blit.flags);
+			break;
+		} case OP_FENCE: {
+			signal_fence(d->sync.addr, d->sync.value, d->sync.flags);
+			break;
+		} case OP_WAIT:		// checked by exec_commands()
+			break;
 	}
 }
 
-// process all in 'commands', up to 'len' bytes
-void command_decoder(uint8_t* commands, uint64_t len) {
+// decode all in 'commands', up to 'len' bytes, replacing the contents of list
+void decode_commands(cmd_list_t* list, uint8_t* commands, uint64_t len) {
 	uint8_t* end = commands + len - 1;
+	list->count = 0;
 
 	while(commands < end) {
 		if(commands + 1 > end) {
@@ -150,7 +477,7 @@ void command_decoder(uint8_t* commands, uint64_t len) {
 			break;
 		}
 		uint16_t op = *(uint16_t*)commands;
-		uint32_t read_amt = exec_cmd(op, commands, end);
+		uint32_t read_amt = decode_cmd(op, commands, end, list);
 		if(!read_amt) {
 			WARN("command decoding stopped due to malformed command (opcode: %x)\n", op);
 			return;
@@ -159,9 +486,92 @@ void command_decoder(uint8_t* commands, uint64_t len) {
 	}
 }
 
-void set_va(uint32_t index, uint32_t va_cfg) {
+// register writes that change nothing but the range drawn by the next draw
+uint8_t is_draw_range_write(cmd_op_t* d) {
+	if(d->type != OP_SET_REG)
+		return 0;
+	uint64_t x1 = d->set_reg.reg_addr, x2 = x1 + d->set_reg.size - 1;
+	return x1 >= BASE_IDX_REG && x2 <= IDX_COUNT_REG + 7;
+}
+
+// draws of one kind separated only by base index and count writes share all
+// pipeline state and are submitted as one multi-draw. returns the index of
+// the last op consumed.
+uint32_t exec_draw_run(cmd_list_t* list, uint32_t start) {
+	uint8_t indexed = list->ops[start].draw.indexed;
+	uint32_t n_instances	= *(uint32_t*)(cmd_regs + INSTANCE_COUNT_REG);
+	uint32_t base_instance	= *(uint32_t*)(cmd_regs + BASE_INSTANCE_REG);
+	uint8_t can_merge = n_instances <= 1 && !base_instance;
+
+	uint32_t n = 0, i;
+	for(i = start; i < list->count && (n == 0 || can_merge); i++) {
+		cmd_op_t* d = &list->ops[i];
+		if(is_draw_range_write(d)) {
+			exec_op(d);
+			continue;
+		}
+		if(d->type != OP_DRAW || d->draw.indirect || d->draw.indexed != indexed)
+			break;
+
+		if(n == draw_capacity) {
+			draw_capacity = draw_capacity ? draw_capacity * 2 : 64;
+			draw_firsts = realloc(draw_firsts, sizeof(GLint) * draw_capacity);
+			draw_counts = realloc(draw_counts, sizeof(GLsizei) * draw_capacity);
+			draw_offsets = realloc(draw_offsets, sizeof(void*) * draw_capacity);
+			draw_base_vertices = realloc(draw_base_vertices,
+				sizeof(GLint) * draw_capacity);
+		}
+		draw_firsts[n] = *(uint64_t*)(cmd_regs + BASE_IDX_REG);
+		draw_counts[n] = *(uint64_t*)(cmd_regs + IDX_COUNT_REG);
+		n++;
+	}
+
+	draw(draw_firsts, draw_counts, n, indexed);
+	return i - 1;
+}
+
+// run the ops of list from index first. returns CMDS_DONE, or the index of a
+// semaphore wait that isn't satisfied yet to resume from, with the wait in
+// blocked_wait.
+uint32_t exec_commands(cmd_list_t* list, uint32_t first) {
+	for(uint32_t i = first; i < list->count; i++) {
+		cmd_op_t* d = &list->ops[i];
+		if(d->type == OP_WAIT) {
+			blocked_wait.addr = d->sync.addr;
+			blocked_wait.value = d->sync.value;
+			blocked_wait.flags = d->sync.flags;
+			if(!semaphore_reached(&blocked_wait))
+				return i;
+		}
+
+		if(d->type == OP_DRAW && !d->draw.indirect)
+			i = exec_draw_run(list, i);
+		else
+			exec_op(d);
+	}
+	return CMDS_DONE;
+}
+
+draw_stats_t* get_draw_stats() {
+	return &draw_stats;
+}
+
+void reset_draw_stats() {
+	memset(&draw_stats, 0, sizeof(draw_stats_t));
+}
+
+// process all in 'commands', up to 'len' bytes, from op index first. returns
+// as exec_commands().
+uint32_t command_decoder(uint8_t* commands, uint64_t len, uint32_t first) {
+	decode_commands(&decoded_cmds, commands, len);
+	return exec_commands(&decoded_cmds, first);
+}
+
+// set the format of attribute index, sourced from vertex buffer binding index.
+// returns the attribute's stride, 0 if it is disabled.
+uint32_t set_va(uint32_t index, uint32_t va_cfg) {
 	if(!(va_cfg & ENABLE_VA_BIT))
-		return;
+		return 0;
 
 	uint8_t normalize = (va_cfg >> 30) & 0x1;
 	uint8_t convert_to_float = (va_cfg >> 29) & 0x1;
@@ -172,7 +582,7 @@ void set_va(uint32_t index, uint32_t va_cfg) {
 
 	if(!IS_VALID_VA_TYPE(type)) {
 		WARN("invalid type, skipping attribute\n");
-		return;
+		return 0;
 	}
 
 	GLenum gl_type		= GET_VA_GL_TYPE(type);
@@ -181,63 +591,109 @@ void set_va(uint32_t index, uint32_t va_cfg) {
 
 	if(type == VA_TYPE_F32 && normalize) {
 		WARN("cannot normalize floating-point, skipping attribute\n");
-		return;
+		return 0;
 	}
 
 	if(type == VA_TYPE_F32 && convert_to_float) {
 		WARN("convert to float is for integers only, skipping attribute\n");
-		return;
+		return 0;
 	}
 
 	if(stride > MAX_VA_STRIDE) {
 		WARN("stride is greater than maximum allowed, skipping attribute\n");
-		return;
+		return 0;
 	}
 
 	if(el_size > stride) {
 		WARN("stride is less than element size, skipping attribute\n");
-		return;
+		return 0;
 	}
 
 	if(offset % comp_size) {
 		WARN("offset not aligned to component size, skipping attribute\n");
-		return;
+		return 0;
 	}
 
 	if(offset + el_size - 1 >= stride) {
 		WARN("attribute end is beyond vertex stride, skipping attribute\n");
-		return;
+		return 0;
 	}
 
 	if(type == VA_TYPE_F32 || convert_to_float)
-		glVertexAttribPointer(index, count, gl_type, normalize ? GL_TRUE : GL_FALSE, stride, (void*)offset);
+		glVertexAttribFormat(index, count, gl_type, normalize ? GL_TRUE : GL_FALSE, offset);
 	else
-		glVertexAttribIPointer(index, count, gl_type, stride, (void*)offset);
+		glVertexAttribIFormat(index, count, gl_type, offset);
 
+	glVertexAttribBinding(index, index);
 	glEnableVertexAttribArray(index);
+	return stride;
 }
 
-// construct + bind VAO for this VBO currently described by command registers
-void bind_vao(object_t* vbo) {
+vao_cache_entry_t* lookup_vao(uint32_t* va_cfg) {
+	uint32_t hash = 2166136261u;	// FNV-1a over the attribute configs
+	for(uint32_t i = 0; i < MAX_VA_COUNT * 4; i++)
+		hash = (hash ^ ((uint8_t*)va_cfg)[i]) * 16777619u;
+
+	vao_cache_entry_t* set = &vao_cache[(hash % (VAO_CACHE_SIZE / VAO_CACHE_WAYS))
+		* VAO_CACHE_WAYS];
+	vao_cache_entry_t* lru = &set[0];
+	for(uint32_t i = 0; i < VAO_CACHE_WAYS; i++) {
+		if(set[i].gl_vao && !memcmp(set[i].va_cfgs, va_cfg, MAX_VA_COUNT * 4))
+			return &set[i];
+		if(!set[i].gl_vao || (lru->gl_vao && set[i].last_use < lru->last_use))
+			lru = &set[i];
+	}
+
+	// build a VAO for this layout in the least recently used way
+	if(!lru->gl_vao)
+		glGenVertexArrays(1, &lru->gl_vao);
+	else {		// reset the formats of the evicted layout
+		glDeleteVertexArrays(1, &lru->gl_vao);
+		glGenVertexArrays(1, &lru->gl_vao);
+	}
+	memmove(lru->va_cfgs, va_cfg, MAX_VA_COUNT * 4);
+	lru->gl_buffer = lru->gl_ibo = 0;
+
+	glBindVertexArray(lru->gl_vao);
+	for(uint32_t i = 0; i < MAX_VA_COUNT; i++)
+		lru->strides[i] = set_va(i, va_cfg[i]);
+	return lru;
+}
+
+// forget vertex buffer bindings of a GL buffer that is being deleted, as its
+// name may be reused
+void forget_vao_buffer(GLuint gl_buffer) {
+	for(uint32_t i = 0; i < VAO_CACHE_SIZE; i++) {
+		if(vao_cache[i].gl_buffer == gl_buffer)
+			vao_cache[i].gl_buffer = 0;
+		if(vao_cache[i].gl_ibo == gl_buffer)
+			vao_cache[i].gl_ibo = 0;
+	}
+}
+
+// bind VAO for the attribute layout currently described by command registers.
+// VAOs are cached by layout; the VBO and IBO, if any, are attached only when
+// they differ from what the VAO last used.
+void bind_vao(object_t* vbo, GLuint gl_ibo) {
 	uint32_t* va_cfg = (uint32_t*)(cmd_regs + VA0_CFG_REG);
 
-	if(vbo->gl_vao) {
-		if(memcmp(va_cfg, vbo->gl_va_cfgs, MAX_VA_COUNT * 4) == 0) {
-			glBindVertexArray(vbo->gl_vao);		// optimal case: no changes
-			return;
-		}
-		glDeleteVertexArrays(1, &vbo->gl_vao);
-	} else
-		vbo->gl_va_cfgs = malloc(MAX_VA_COUNT * 4);
+	vao_cache_entry_t* entry = lookup_vao(va_cfg);
+	entry->last_use = ++vao_use_counter;
+	glBindVertexArray(entry->gl_vao);
 
-	memmove(vbo->gl_va_cfgs, va_cfg, MAX_VA_COUNT * 4);
+	if(gl_ibo && entry->gl_ibo != gl_ibo) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl_ibo);
+		entry->gl_ibo = gl_ibo;
+	}
 
-	glGenVertexArrays(1, &vbo->gl_vao);
-	glBindVertexArray(vbo->gl_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo->gl_buffer);
+	if(entry->gl_buffer == vbo->gl_buffer && entry->offset == vbo->gl_offset)
+		return;		// optimal case: no changes
 
-	for(uint32_t i = 0; i < MAX_VA_COUNT; i++, va_cfg++)
-		set_va(i, *va_cfg);
+	for(uint32_t i = 0; i < MAX_VA_COUNT; i++)
+		if(entry->strides[i])
+			glBindVertexBuffer(i, vbo->gl_buffer, vbo->gl_offset, entry->strides[i]);
+	entry->gl_buffer = vbo->gl_buffer;
+	entry->offset = vbo->gl_offset;
 }
 
 void gl_bind_attachment(GLenum target, object_t* tbo) {
@@ -269,16 +725,50 @@ void gl_set_draw_buffers(uint8_t bmp) {
 	glDrawBuffers(MAX_COLOR_ATTACH_COUNT, buffs);
 }
 
-// construct + bind FBO currently described by command registers
-void bind_fbo() {
-	if(gl_fbo)
-		glDeleteFramebuffers(1, &gl_fbo);
+fbo_cache_entry_t* lookup_fbo(fbo_cache_entry_t* key) {
+	fbo_cache_entry_t* lru = &fbo_cache[0];
+	for(uint32_t i = 0; i < FBO_CACHE_SIZE; i++) {
+		fbo_cache_entry_t* entry = &fbo_cache[i];
+		if(entry->gl_fbo && entry->fb_cfg == key->fb_cfg
+		&& !memcmp(entry->attach_addrs, key->attach_addrs, sizeof(key->attach_addrs))
+		&& !memcmp(entry->attach_gens, key->attach_gens, sizeof(key->attach_gens)))
+			return entry;
+		if(!entry->gl_fbo || (lru->gl_fbo && entry->last_use < lru->last_use))
+			lru = entry;
+	}
 
-	glGenFramebuffers(1, &gl_fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, gl_fbo);
-	fbo_dims[0] = fbo_dims[1] = 0;
-	fbo_n_color_attachs = 0;
+	// build the framebuffer in the least recently used slot
+	if(lru->gl_fbo)
+		glDeleteFramebuffers(1, &lru->gl_fbo);
+	*lru = *key;
+	lru->gl_fbo = 0;
+	return lru;
+}
 
+// drop cached framebuffers using a texture object that is being freed
+void forget_fbos(object_t* tbo) {
+	for(uint32_t i = 0; i < FBO_CACHE_SIZE; i++) {
+		fbo_cache_entry_t* entry = &fbo_cache[i];
+		if(!entry->gl_fbo)
+			continue;
+
+		for(uint32_t j = 0; j <= MAX_COLOR_ATTACH_COUNT; j++) {
+			if(entry->attach_gens[j] != tbo->generation)
+				continue;
+			if(entry->gl_fbo == gl_fbo) {
+				gl_fbo = 0;
+				mark_state_dirty(STATE_FBO);
+			}
+			glDeleteFramebuffers(1, &entry->gl_fbo);
+			entry->gl_fbo = 0;
+			break;
+		}
+	}
+}
+
+// get the attachments described by command registers, 0 if they are invalid.
+// the depth attachment goes in the last slot of tbos.
+uint8_t get_attachments(object_t** tbos) {
 	uint32_t fb_cfg = *(uint32_t*)(cmd_regs + FB_CFG_REG);
 	uint32_t n_color_attachs = fb_cfg & 0xFF;
 	uint8_t has_depth_attach = (fb_cfg & ENABLE_DEPTH_ATTACH_BIT) > 0;
@@ -286,7 +776,13 @@ void bind_fbo() {
 	if(n_color_attachs == 0 && !has_depth_attach) {
 		WARN("no configured color or depth attachments (you probably want to "
 			"set a render target)\n");
-		return;
+		return 0;
+	}
+
+	if(n_color_attachs > MAX_COLOR_ATTACH_COUNT) {
+		WARN("%d color attachments configured, maximum is %d\n",
+			n_color_attachs, MAX_COLOR_ATTACH_COUNT);
+		return 0;
 	}
 
 	for(uint32_t i = 0; i < n_color_attachs; i++) {
@@ -294,13 +790,13 @@ void bind_fbo() {
 		object_t* tbo = ref_buffer_precise(tbo_addr, TYPE_TBO, LENGTH_IN_BUFFER);
 		if(!tbo) {
 			WARN("failed to get tbo %llx for color attachment %d\n", tbo_addr, i);
-			return;
+			return 0;
 		}
 		if(!IS_COLOR_FORMAT(tbo->header.tex_format)) {
 			WARN("tbo %llx for color attachment is not of color format\n", tbo->addr);
-			return;
+			return 0;
 		}
-		gl_bind_attachment(GL_COLOR_ATTACHMENT0 + i, tbo);
+		tbos[i] = tbo;
 	}
 
 	if(has_depth_attach) {
@@ -308,25 +804,87 @@ void bind_fbo() {
 		object_t* tbo = ref_buffer_precise(tbo_addr, TYPE_TBO, LENGTH_IN_BUFFER);
 		if(!tbo) {
 			WARN("failed to get tbo %llx for depth attachment\n", tbo_addr);
-			return;
+			return 0;
 		}
 		if(IS_COLOR_FORMAT(tbo->header.tex_format)) {
 			WARN("tbo %llx for depth attachment is not of depth format\n", tbo->addr);
-			return;
+			return 0;
 		}
-
-		if(IS_DEPTH_FORMAT(tbo->header.tex_format))
-			gl_bind_attachment(GL_DEPTH_ATTACHMENT, tbo);
-		else if(IS_DEPTH_STENCIL_FORMAT(tbo->header.tex_format))
-			gl_bind_attachment(GL_DEPTH_STENCIL_ATTACHMENT, tbo);
+		tbos[MAX_COLOR_ATTACH_COUNT] = tbo;
 	}
+	return 1;
+}
 
-	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if(status != GL_FRAMEBUFFER_COMPLETE) {
-		WARN("framebuffer was incomplete\n");
+// bind FBO currently described by command registers. framebuffers are cached
+// by attachment configuration, so only the first bind checks completeness.
+void bind_fbo() {
+	fbo_dims[0] = fbo_dims[1] = 0;
+	fbo_n_color_attachs = 0;
+	clear_bindings(BIND_FBO);
+
+	uint32_t fb_cfg = *(uint32_t*)(cmd_regs + FB_CFG_REG);
+	uint32_t n_color_attachs = fb_cfg & 0xFF;
+
+	object_t* tbos[MAX_COLOR_ATTACH_COUNT + 1];
+	memset(tbos, 0, sizeof(tbos));
+
+	if(!get_attachments(tbos)) {
+		// draws are dropped on a framebuffer without attachments
+		if(!empty_fbo)
+			glGenFramebuffers(1, &empty_fbo);
+		gl_fbo = empty_fbo;
+		glBindFramebuffer(GL_FRAMEBUFFER, gl_fbo);
 		return;
 	}
 
+	fbo_cache_entry_t key;
+	memset(&key, 0, sizeof(fbo_cache_entry_t));
+	key.fb_cfg = fb_cfg;
+	for(uint32_t i = 0; i <= MAX_COLOR_ATTACH_COUNT; i++) {
+		if(!tbos[i])
+			continue;
+		key.attach_addrs[i] = tbos[i]->addr;
+		key.attach_gens[i] = tbos[i]->generation;
+		add_binding(BIND_FBO, tbos[i]);
+	}
+
+	fbo_cache_entry_t* entry = lookup_fbo(&key);
+	entry->last_use = ++fbo_use_counter;
+
+	if(entry->gl_fbo) {		// optimal case: framebuffer was built before
+		gl_fbo = entry->gl_fbo;
+		glBindFramebuffer(GL_FRAMEBUFFER, gl_fbo);
+		fbo_dims[0] = entry->dims[0];
+		fbo_dims[1] = entry->dims[1];
+		if(!entry->complete) {
+			WARN("framebuffer was incomplete\n");
+			return;
+		}
+	} else {
+		glGenFramebuffers(1, &entry->gl_fbo);
+		gl_fbo = entry->gl_fbo;
+		glBindFramebuffer(GL_FRAMEBUFFER, gl_fbo);
+
+		for(uint32_t i = 0; i < n_color_attachs; i++)
+			gl_bind_attachment(GL_COLOR_ATTACHMENT0 + i, tbos[i]);
+
+		object_t* depth = tbos[MAX_COLOR_ATTACH_COUNT];
+		if(depth && IS_DEPTH_FORMAT(depth->header.tex_format))
+			gl_bind_attachment(GL_DEPTH_ATTACHMENT, depth);
+		else if(depth && IS_DEPTH_STENCIL_FORMAT(depth->header.tex_format))
+			gl_bind_attachment(GL_DEPTH_STENCIL_ATTACHMENT, depth);
+
+		entry->dims[0] = fbo_dims[0];
+		entry->dims[1] = fbo_dims[1];
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		entry->complete = status == GL_FRAMEBUFFER_COMPLETE;
+		if(!entry->complete) {
+			WARN("framebuffer was incomplete\n");
+			return;
+		}
+	}
+
 	gl_set_draw_buffers((1 << n_color_attachs) - 1);
 	fbo_n_color_attachs = n_color_attachs;
 
@@ -5,11 +5,41 @@
 #define MAX_VA_STRIDE			2048
 #define MAX_COLOR_ATTACH_COUNT	8
 #define MAX_DTABLE_COUNT		4
+#define FBO_CACHE_SIZE			16
+#define VAO_CACHE_SIZE			64
+#define VAO_CACHE_WAYS			4
 
 #define CMD_SET_REG_32		1
 #define CMD_SET_REG_64		2
 #define CMD_DRAW			3
 #define CMD_CLEAR_ATTACHS	4
+#define CMD_DRAW_INDEXED	5
+#define CMD_DRAW_INDIRECT	6
+#define CMD_DRAW_INDEXED_INDIRECT	7
+#define CMD_COPY_BUFFER		8
+#define CMD_FILL_BUFFER		9
+#define CMD_BLIT_TEXTURE	10
+#define CMD_SIGNAL_FENCE	11
+#define CMD_WAIT_SEMAPHORE	12
+
+// decoded command types
+#define OP_SET_REG			1
+#define OP_DRAW				2
+#define OP_CLEAR			3
+#define OP_COPY				4
+#define OP_FILL				5
+#define OP_BLIT				6
+#define OP_FENCE			7
+#define OP_WAIT				8
+
+// state derived from command registers, resolved at the next draw or clear
+#define STATE_FBO			(1 << 0)
+#define STATE_DTABLES		(1 << 1)
+#define STATE_KERNEL		(1 << 2)
+#define STATE_UNIFORMS		(1 << 3)
+#define STATE_ALL			0xF
+
+#define CMDS_DONE			0xFFFFFFFF	/* returned once a command list has fully run */
 
 #define NUM_BYTES_CMD_REGS	1024		/* TODO: this is a placeholder value */
 #define FB_CFG_REG			0x0
@@ -27,6 +57,20 @@
 #define DTBL_0_ADDR_REG		0xBC		/* MAX_DTABLE_COUNT */
 #define KERNEL_ADDR_REG		0xCC
 #define UNIFORM_0_REG		0xD4		/* 128 bytes */
+#define IBO_ADDR_REG		0x154
+#define IBO_LEN_REG			0x15C
+#define DRAW_CFG_REG		0x164
+#define INSTANCE_COUNT_REG	0x168		/* 0 draws a single instance */
+#define BASE_INSTANCE_REG	0x16C
+#define BASE_VERTEX_REG		0x170		/* signed, added to indices */
+#define INDIRECT_ADDR_REG	0x174		/* SBO holding indirect draw records */
+#define INDIRECT_LEN_REG	0x17C
+#define INDIRECT_COUNT_REG	0x184
+
+// indirect draw record sizes, matching GL's DrawArraysIndirectCommand and
+// DrawElementsIndirectCommand
+#define INDIRECT_DRAW_SIZE			16
+#define INDIRECT_INDEXED_DRAW_SIZE	20
 
 #define ENABLE_DEPTH_ATTACH_BIT	(1 << 31)
 #define ENABLE_VA_BIT		(1 << 31)
@@ -34,6 +78,23 @@
 #define CLEAR_DEPTH_ATTACH_BIT (1 << 31)
 #define CLEAR_STENCIL_ATTACH_BIT (1 << 30)
 
+// DRAW_CFG_REG fields
+#define GET_TOPOLOGY(x)		((x) & 0x7)
+#define GET_INDEX_TYPE(x)	(((x) >> 8) & 0x3)
+
+#define TOPOLOGY_TRIANGLES		0
+#define TOPOLOGY_TRIANGLE_STRIP	1
+#define TOPOLOGY_TRIANGLE_FAN	2
+#define TOPOLOGY_LINES			3
+#define TOPOLOGY_LINE_STRIP		4
+#define TOPOLOGY_POINTS			5
+#define IS_VALID_TOPOLOGY(x)	(x <= 5)
+
+#define INDEX_TYPE_U8		0
+#define INDEX_TYPE_U16		1
+#define INDEX_TYPE_U32		2
+#define IS_VALID_INDEX_TYPE(x)	(x <= 2)
+
 #define VA_TYPE_I8			0
 #define VA_TYPE_I16			1
 #define VA_TYPE_I32			2
@@ -66,6 +127,103 @@ static va_type va_type_info[] = {
 #define GET_VA_GL_TYPE(x)			va_type_info[x].gl_type
 #define GET_VA_COMPONENT_WIDTH(x)	va_type_info[x].width
 
-void command_decoder(uint8_t* commands, uint64_t len);
+// validated command, ready to execute without touching the command buffer
+typedef struct cmd_op_t {
+	uint8_t type;
+	union {
+		struct {
+			uint64_t reg_addr;
+			uint64_t value;
+			uint8_t size;
+			uint8_t effects;	// STATE_* bits made dirty by the write
+		} set_reg;
+		struct {
+			uint8_t indexed;
+			uint8_t indirect;	// parameters come from an SBO
+		} draw;
+		struct {
+			uint32_t bmp;
+			float rgba[4];
+			float depth;
+			uint8_t stencil;
+		} clear;
+		struct {
+			uint64_t dst;
+			uint64_t src;		// copies only
+			uint64_t len;
+			uint32_t value;		// fills only
+		} xfer;
+		struct {
+			uint64_t dst;
+			uint64_t src;
+			uint32_t dst_rect[4];
+			uint32_t src_rect[4];
+			uint32_t flags;
+		} blit;
+		struct {
+			uint64_t addr;
+			uint64_t value;
+			uint32_t flags;		// FENCE_* bits
+		} sync;
+	};
+} cmd_op_t;
+
+typedef struct cmd_list_t {
+	uint32_t count;
+	uint32_t capacity;
+	cmd_op_t* ops;
+} cmd_list_t;
+
+// GL framebuffer for one attachment configuration. attachments are indexed
+// by color attachment, with the depth attachment last.
+typedef struct fbo_cache_entry_t {
+	GLuint gl_fbo;			// 0 if the entry is empty
+	uint32_t fb_cfg;
+	uint64_t attach_addrs[MAX_COLOR_ATTACH_COUNT + 1];
+	uint64_t attach_gens[MAX_COLOR_ATTACH_COUNT + 1];	// object generations
+	uint32_t dims[2];
+	uint8_t complete;
+	uint64_t last_use;
+} fbo_cache_entry_t;
+
+// VAO for one vertex attribute layout, in a set-associative cache hashed by
+// the VA*_CFG register values
+typedef struct vao_cache_entry_t {
+	GLuint gl_vao;			// 0 if the entry is empty
+	uint32_t va_cfgs[MAX_VA_COUNT];
+	uint32_t strides[MAX_VA_COUNT];		// 0 for disabled attributes
+	GLuint gl_buffer;		// vertex buffer currently bound to the VAO
+	uint64_t offset;
+	GLuint gl_ibo;			// index buffer currently bound to the VAO
+	uint64_t last_use;
+} vao_cache_entry_t;
+
+// buffers and parameters of the draw being issued, see begin_draw()
+typedef struct draw_state_t {
+	GLenum mode;
+	object_t* vbo;
+	object_t* ibo;			// indexed draws only
+	GLuint gl_ibo;			// element buffer to use instead of the IBO's, if set
+	GLenum index_type;
+	uint32_t index_size;
+	uint32_t n_instances;
+	uint32_t base_instance;
+	int32_t base_vertex;
+} draw_state_t;
+
+// draws since the last reset_draw_stats()
+typedef struct draw_stats_t {
+	uint64_t draws;			// draw commands executed
+	uint64_t gl_draw_calls;	// GL calls they were submitted with
+} draw_stats_t;
+
+void mark_state_dirty(uint8_t state);
+void forget_fbos(object_t* tbo);
+void forget_vao_buffer(GLuint gl_buffer);
+void decode_commands(cmd_list_t* list, uint8_t* commands, uint64_t len);
+uint32_t exec_commands(cmd_list_t* list, uint32_t first);
+uint32_t command_decoder(uint8_t* commands, uint64_t len, uint32_t first);
+draw_stats_t* get_draw_stats();
+void reset_draw_stats();
 
 #endif
@@ -1,74 +1,306 @@
 #include "../../defs.h"
+#include <unistd.h>
 
-#define READ_FROM_DEVICE 0
-#define WRITE_TO_DEVICE  1
+// descriptors are taken from the ring on the thread writing the registers and
+// started on the GPU thread. copies are split into chunks for a pool of copy
+// engine threads; the engine finishing the last chunk completes the descriptor.
+pthread_mutex_t dma_ring_mx = PTHREAD_MUTEX_INITIALIZER;
 
-uint8_t ongoing_read, ongoing_write;
+pthread_mutex_t copy_mx = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t copy_cv = PTHREAD_COND_INITIALIZER;
+copy_chunk_t *chunks_head, *chunks_tail;
+pthread_once_t copy_engines_once = PTHREAD_ONCE_INIT;
 
-typedef struct copy_args_t {
-	uint8_t copy_type;
-	uint8_t *dst, *src;
-	uint64_t n;
-} copy_args_t;
+void complete_transfer(dma_transfer_t* t, uint32_t status) {
+	// failed transfers copy nothing, so no reported entry has completed
+	for(uint32_t i = 0; i < t->n_entries && status == DMA_STATUS_ERROR; i++)
+		if(t->entries[i].status_addr)
+			*(uint32_t*)(get_ram() + t->entries[i].status_addr) = DMA_STATUS_ERROR;
 
-void copy_thread_func(copy_args_t* a) {
-	memcpy(a->dst, a->src, a->n);
+	uint32_t* desc_status = (uint32_t*)(get_ram() + t->desc_addr + DMA_DESC_STATUS);
+	__atomic_store_n(desc_status, status, __ATOMIC_RELEASE);
 
-	if(a->copy_type == READ_FROM_DEVICE) {
-		atomic_set_u8(&ongoing_read, 0);
-		*(uint32_t*)(get_ram() + READ_CTRL_REG) &= ~REQUEST_READ_BIT;
-	} else {
-		atomic_set_u8(&ongoing_write, 0);
-		*(uint32_t*)(get_ram() + WRITE_CTRL_REG) &= ~REQUEST_WRITE_BIT;
+	if(t->ctrl & DMA_IRQ_BIT) {
+		if(t->ctrl & DMA_TO_DEVICE_BIT)
+			dma_write_complete_irq();
+		else
+			dma_read_complete_irq();
 	}
+	free(t->entries);
+	free(t);
+}
 
-	if(a->copy_type == READ_FROM_DEVICE)
-		dma_read_complete_irq();
-	else
-		dma_write_complete_irq();
-	free(a);
+void* copy_engine_func(void* args) {
+	while(1) {
+		pthread_mutex_lock(&copy_mx);
+		while(!chunks_head)
+			pthread_cond_wait(&copy_cv, &copy_mx);
+		copy_chunk_t* c = chunks_head;
+		chunks_head = c->next;
+		if(!chunks_head)
+			chunks_tail = 0;
+		pthread_mutex_unlock(&copy_mx);
+
+		memcpy(c->dst, c->src, c->n);
+
+		if(c->entry && !__atomic_sub_fetch(&c->entry->remaining, 1, __ATOMIC_ACQ_REL))
+			__atomic_store_n((uint32_t*)(get_ram() + c->entry->status_addr),
+				DMA_STATUS_DONE, __ATOMIC_RELEASE);
+		if(!__atomic_sub_fetch(&c->transfer->remaining, 1, __ATOMIC_ACQ_REL))
+			complete_transfer(c->transfer, DMA_STATUS_DONE);
+		free(c);
+	}
+	return NULL;
 }
 
-void launch_copy_thread(uint64_t dst, uint64_t src, uint64_t n, uint8_t type,
-	uint8_t* ongoing_status, uint8_t* dst_ptr, uint8_t* src_ptr) {
-	if(atomic_get_u8(ongoing_status))
-		return;
+void init_copy_engines() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1)
+		n = 1;
+	if(n > MAX_COPY_ENGINES)
+		n = MAX_COPY_ENGINES;
 
-	uint64_t end = dst + n - 1;
-	if(end >= RAM_CAPACITY || end >= VRAM_CAPACITY)
-		return;
+	for(long i = 0; i < n; i++) {
+		pthread_t engine;
+		pthread_create(&engine, NULL, copy_engine_func, NULL);
+		pthread_detach(engine);
+	}
+}
+
+// queue the chunks of every entry of a transfer for the copy engines
+void submit_chunks(dma_transfer_t* t) {
+	pthread_once(&copy_engines_once, init_copy_engines);
+
+	uint8_t to_device = (t->ctrl & DMA_TO_DEVICE_BIT) > 0;
+	copy_chunk_t *head = 0, *tail = 0;
+	t->remaining = 0;
+
+	for(uint32_t i = 0; i < t->n_entries; i++) {
+		dma_entry_t* e = &t->entries[i];
+		uint8_t* dst = to_device ? vram + e->dst : get_ram() + e->dst;
+		uint8_t* src = to_device ? get_ram() + e->src : vram + e->src;
 
-	atomic_set_u8(ongoing_status, 1);
+		e->remaining = (e->n + DMA_CHUNK_SIZE - 1) / DMA_CHUNK_SIZE;
+		t->remaining += e->remaining;
+		if(!e->n && e->status_addr)
+			*(uint32_t*)(get_ram() + e->status_addr) = DMA_STATUS_DONE;
 
-	if(type == READ_FROM_DEVICE) {
-		uint32_t count = get_region_object_count(src, n);
-		for(uint32_t i = 0; i < count; i++) {
-			object_t* obj = get_region_object_list(i, src, n);
-			flush_object(obj);
+		for(uint64_t offset = 0; offset < e->n; offset += DMA_CHUNK_SIZE) {
+			copy_chunk_t* c = malloc(sizeof(copy_chunk_t));
+			c->transfer = t;
+			c->entry = e->status_addr ? e : 0;
+			c->dst = dst + offset;
+			c->src = src + offset;
+			c->n = e->n - offset < DMA_CHUNK_SIZE ? e->n - offset : DMA_CHUNK_SIZE;
+			c->next = 0;
+			if(tail)
+				tail->next = c;
+			else
+				head = c;
+			tail = c;
 		}
-	} else {
-		uint32_t count = get_region_object_count(dst, n);
-		for(uint32_t i = 0; i < count; i++) {
-			object_t* obj = get_region_object_list(i, dst, n);
-			obj->need_update = 1;
+	}
+
+	if(!head) {		// nothing to copy
+		complete_transfer(t, DMA_STATUS_DONE);
+		return;
+	}
+
+	pthread_mutex_lock(&copy_mx);
+	if(chunks_tail)
+		chunks_tail->next = head;
+	else
+		chunks_head = head;
+	chunks_tail = tail;
+	pthread_cond_broadcast(&copy_cv);
+	pthread_mutex_unlock(&copy_mx);
+}
+
+uint8_t in_bounds(uint64_t addr, uint64_t n, uint64_t capacity) {
+	return addr <= capacity && n <= capacity - addr;
+}
+
+// read the entries of a transfer from its scatter-gather list, or make the
+// single entry of a plain descriptor. returns 0 if the list is invalid.
+uint8_t load_entries(dma_transfer_t* t, uint64_t dst, uint64_t src, uint64_t n) {
+	if(!(t->ctrl & DMA_LIST_BIT)) {
+		t->n_entries = 1;
+		t->entries = calloc(1, sizeof(dma_entry_t));
+		t->entries->dst = dst;
+		t->entries->src = src;
+		t->entries->n = n;
+		return 1;
+	}
+
+	if(n > MAX_DMA_LIST_ENTRIES || src % 8 || !in_bounds(src, n * DMA_ENTRY_SIZE, RAM_CAPACITY)) {
+		WARN("DMA list at %llx with %llu entries is invalid\n", src, n);
+		return 0;
+	}
+
+	t->n_entries = n;
+	t->entries = calloc(n, sizeof(dma_entry_t));
+	for(uint32_t i = 0; i < n; i++) {
+		uint64_t entry_addr = src + i * DMA_ENTRY_SIZE;
+		uint8_t* entry = get_ram() + entry_addr;
+		dma_entry_t* e = &t->entries[i];
+		e->dst = *(uint64_t*)(entry + DMA_ENTRY_DST);
+		e->src = *(uint64_t*)(entry + DMA_ENTRY_SRC);
+		e->n = *(uint64_t*)(entry + DMA_ENTRY_LEN);
+		if(*(uint32_t*)(entry + DMA_ENTRY_FLAGS) & DMA_ENTRY_STATUS_BIT) {
+			e->status_addr = entry_addr + DMA_ENTRY_STATUS;
+			*(uint32_t*)(entry + DMA_ENTRY_STATUS) = DMA_STATUS_QUEUED;
 		}
 	}
+	return 1;
+}
+
+typedef struct vram_range_t {
+	uint64_t start, end;	// inclusive
+} vram_range_t;
+
+int compare_ranges(const void* a, const void* b) {
+	uint64_t x = ((vram_range_t*)a)->start, y = ((vram_range_t*)b)->start;
+	return x < y ? -1 : x > y;
+}
+
+// bring objects and VRAM up to date for every entry at once. VRAM ranges are
+// merged first so objects spanning several entries are handled once. reads
+// may leave readbacks pending on t.
+void prepare_entries(dma_transfer_t* t) {
+	uint8_t to_device = (t->ctrl & DMA_TO_DEVICE_BIT) > 0;
+	vram_range_t* ranges = malloc(sizeof(vram_range_t) * t->n_entries);
+	uint32_t n_ranges = 0;
+
+	for(uint32_t i = 0; i < t->n_entries; i++) {
+		dma_entry_t* e = &t->entries[i];
+		if(!e->n)
+			continue;
+		ranges[n_ranges].start = to_device ? e->dst : e->src;
+		ranges[n_ranges].end = ranges[n_ranges].start + e->n - 1;
+		n_ranges++;
+	}
+	qsort(ranges, n_ranges, sizeof(vram_range_t), compare_ranges);
 
-	copy_args_t* args = malloc(sizeof(copy_args_t));
-	args->copy_type = type;
-	args->dst = dst_ptr;
-	args->src = src_ptr;
-	args->n = n;
+	uint32_t merged = 0;
+	for(uint32_t i = 0; i < n_ranges; i++) {
+		if(merged && ranges[i].start <= ranges[merged - 1].end + 1) {
+			if(ranges[i].end > ranges[merged - 1].end)
+				ranges[merged - 1].end = ranges[i].end;
+		} else
+			ranges[merged++] = ranges[i];
+	}
+
+	objvec_t flushed = { 0 };
+	for(uint32_t i = 0; i < merged; i++) {
+		uint64_t len = ranges[i].end - ranges[i].start + 1;
+		if(to_device)
+			land_readbacks(ranges[i].start, len);
 
-	pthread_t copy_thread;
-	pthread_create(&copy_thread, NULL, copy_thread_func, args);
-	pthread_detach(copy_thread);
+		region_query_t q;
+		uint32_t count = query_region(&q, ranges[i].start, len);
+		for(uint32_t j = 0; j < count; j++) {
+			object_t* obj = q.hits[j].obj;
+			if(to_device) {
+				obj->need_update = 1;
+				continue;
+			}
+
+			uint8_t seen = 0;
+			for(uint32_t k = 0; k < flushed.count && !seen; k++)
+				seen = OBJVEC_DATA(&flushed)[k] == obj;
+			if(!seen) {
+				read_back_object(obj, t);
+				objvec_push(&flushed, obj);
+			}
+		}
+		free_region_query(&q);
+
+		if(to_device)
+			vram_written(ranges[i].start, len);
+	}
+
+	objvec_free(&flushed);
+	free(ranges);
 }
 
-void request_read(uint64_t dst, uint64_t src, uint64_t n) {
-	launch_copy_thread(dst, src, n, READ_FROM_DEVICE, &ongoing_read, get_ram() + dst, vram + src);
+// runs on the GPU thread, which owns the objects the copy must stay coherent
+// with. for list descriptors src and n give the list and its entry count.
+void start_dma(uint64_t dst, uint64_t src, uint64_t n, uint32_t ctrl,
+	uint64_t desc_addr) {
+	dma_transfer_t* t = calloc(1, sizeof(dma_transfer_t));
+	t->desc_addr = desc_addr;
+	t->ctrl = ctrl;
+
+	if(!load_entries(t, dst, src, n)) {
+		complete_transfer(t, DMA_STATUS_ERROR);
+		return;
+	}
+
+	uint8_t to_device = (ctrl & DMA_TO_DEVICE_BIT) > 0;
+	for(uint32_t i = 0; i < t->n_entries; i++) {
+		dma_entry_t* e = &t->entries[i];
+		uint64_t ram_addr = to_device ? e->src : e->dst;
+		uint64_t vram_addr = to_device ? e->dst : e->src;
+		if(!in_bounds(ram_addr, e->n, RAM_CAPACITY) || !in_bounds(vram_addr, e->n, VRAM_CAPACITY)) {
+			WARN("DMA %s [%llx, %llx] out of bounds\n", to_device ? "write" : "read",
+				vram_addr, vram_addr + e->n - 1);
+			complete_transfer(t, DMA_STATUS_ERROR);
+			return;
+		}
+	}
+
+	// reads start copying once every readback they wait on has landed. held
+	// while they are issued, as land_readbacks() may land some early.
+	t->pending_readbacks++;
+	prepare_entries(t);
+	if(!--t->pending_readbacks)
+		submit_chunks(t);
 }
 
-void request_write(uint64_t dst, uint64_t src, uint64_t n) {
-	launch_copy_thread(dst, src, n, WRITE_TO_DEVICE, &ongoing_write, vram + dst, get_ram() + src);
+// queue the descriptors submitted since the last call. each is copied out of
+// the ring before DMA_HEAD_REG moves past it.
+void take_dma_descriptors() {
+	uint8_t* ram = get_ram();
+	uint32_t* head = (uint32_t*)&ram[DMA_HEAD_REG];
+	uint32_t tail = *(uint32_t*)&ram[DMA_TAIL_REG];
+
+	pthread_mutex_lock(&dma_ring_mx);
+	if(*head == tail) {
+		pthread_mutex_unlock(&dma_ring_mx);
+		return;
+	}
+
+	uint64_t ring_addr = *(uint64_t*)&ram[DMA_RING_ADDR_REG];
+	uint32_t ring_size = *(uint32_t*)&ram[DMA_RING_SIZE_REG];
+	if(!ring_size || ring_size > MAX_DMA_RING_SIZE || (ring_size & (ring_size - 1)) ||
+		ring_addr % DMA_DESC_SIZE ||
+		!in_bounds(ring_addr, (uint64_t)ring_size * DMA_DESC_SIZE, RAM_CAPACITY)) {
+		WARN("DMA ring at %llx with %u descriptors is invalid, dropping descriptors\n",
+			ring_addr, ring_size);
+		*head = tail;
+		pthread_mutex_unlock(&dma_ring_mx);
+		return;
+	}
+	if(tail - *head > ring_size) {
+		WARN("DMA ring tail %u is more than the ring size ahead of head %u, "
+			"dropping descriptors\n", tail, *head);
+		*head = tail;
+		pthread_mutex_unlock(&dma_ring_mx);
+		return;
+	}
+
+	for(; *head != tail; (*head)++) {
+		uint64_t desc_addr = ring_addr + (uint64_t)(*head % ring_size) * DMA_DESC_SIZE;
+		uint8_t* desc = ram + desc_addr;
+
+		gpu_cmd_t cmd = { .type = GPU_CMD_DMA };
+		cmd.args[0] = *(uint64_t*)(desc + DMA_DESC_DST);
+		cmd.args[1] = *(uint64_t*)(desc + DMA_DESC_SRC);
+		cmd.args[2] = *(uint64_t*)(desc + DMA_DESC_LEN);
+		cmd.args[3] = *(uint32_t*)(desc + DMA_DESC_CTRL);
+		cmd.args[4] = desc_addr;
+		*(uint32_t*)(desc + DMA_DESC_STATUS) = DMA_STATUS_QUEUED;
+		push_gpu_cmd(&cmd);
+	}
+	pthread_mutex_unlock(&dma_ring_mx);
 }
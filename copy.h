@@ -1,7 +1,71 @@
 #ifndef COPY_H
 #define COPY_H
 
-void request_read(uint64_t dst, uint64_t src, uint64_t n);
-void request_write(uint64_t dst, uint64_t src, uint64_t n);
+#include "../../defs.h"
+
+#define MAX_DMA_RING_SIZE	4096		/* descriptors */
+#define MAX_COPY_ENGINES	8
+#define DMA_CHUNK_SIZE		0x40000		/* transfers are split into chunks of this size */
+#define MAX_DMA_LIST_ENTRIES	4096
+
+// DMA descriptor layout, in the RAM ring at DMA_RING_ADDR_REG
+#define DMA_DESC_SIZE		32
+#define DMA_DESC_CTRL		0x0
+#define DMA_DESC_STATUS		0x4			/* written by the GPU */
+#define DMA_DESC_DST		0x8
+#define DMA_DESC_SRC		0x10
+#define DMA_DESC_LEN		0x18
+
+// descriptor control flags
+#define DMA_TO_DEVICE_BIT	(1 << 0)	/* RAM to VRAM, else VRAM to RAM */
+#define DMA_IRQ_BIT			(1 << 1)	/* raise dma_*_complete_irq() when done */
+#define DMA_LIST_BIT		(1 << 2)	/* src is a RAM list of entries, len their count */
+
+// scatter-gather list entry layout. entries copy in the descriptor's direction.
+#define DMA_ENTRY_SIZE		32
+#define DMA_ENTRY_FLAGS		0x0
+#define DMA_ENTRY_STATUS	0x4
+#define DMA_ENTRY_DST		0x8
+#define DMA_ENTRY_SRC		0x10
+#define DMA_ENTRY_LEN		0x18
+
+// list entry flags
+#define DMA_ENTRY_STATUS_BIT	(1 << 0)	/* write the entry's status once it is copied */
+
+// descriptor status values
+#define DMA_STATUS_PENDING	0			/* set by the CPU when writing the descriptor */
+#define DMA_STATUS_QUEUED	1
+#define DMA_STATUS_DONE		2
+#define DMA_STATUS_ERROR	3
+
+// one contiguous copy of a transfer
+typedef struct dma_entry_t {
+	uint64_t dst, src, n;
+	uint64_t status_addr;	// RAM address of the entry status, 0 if not reported
+	uint32_t remaining;		// chunks not yet copied
+} dma_entry_t;
+
+// all entries of a descriptor, completed together
+typedef struct dma_transfer_t {
+	uint64_t desc_addr;
+	uint32_t ctrl;
+	uint32_t remaining;		// chunks not yet copied
+	uint32_t pending_readbacks;		// copies wait until these land in VRAM
+	dma_entry_t* entries;
+	uint32_t n_entries;
+} dma_transfer_t;
+
+typedef struct copy_chunk_t {
+	dma_transfer_t* transfer;
+	dma_entry_t* entry;		// set if the entry reports its own completion
+	uint8_t *dst, *src;
+	uint64_t n;
+	struct copy_chunk_t* next;
+} copy_chunk_t;
+
+void take_dma_descriptors();
+void submit_chunks(dma_transfer_t* t);
+void start_dma(uint64_t dst, uint64_t src, uint64_t n, uint32_t ctrl,
+	uint64_t desc_addr);
 
 #endif
@@ -50,18 +50,25 @@ void load_dtable(uint32_t dtbl_slot, node_t* accesses) {
 			return;
 		}
 
-		// bind obj->gl_buffer using info recorded in d->bind_point
+		add_binding(BIND_DTABLES, obj);
+
+		// bind obj->gl_buffer using info recorded in d->bind_point. buffers are
+		// views into a shared store, at offsets that keep the 256-byte
+		// alignment of their addresses.
 		if(obj->type == TYPE_UBO) {
 			glUniformBlockBinding(get_gl_program(), d->bind_point.location,
 				d->bind_point.binding);
-			glBindBufferBase(GL_UNIFORM_BUFFER, d->bind_point.binding,
-				obj->gl_buffer);
+			glBindBufferRange(GL_UNIFORM_BUFFER, d->bind_point.binding,
+				obj->gl_buffer, obj->gl_offset, obj->len);
 		}
 		if(obj->type == TYPE_SBO) {
+			// shader writes may change headers of aliasing objects
+			if(obj->in_overlaps)
+				vram_written(obj->addr, obj->len);
 			glShaderStorageBlockBinding(get_gl_program(), d->bind_point.location,
 				d->bind_point.binding);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, d->bind_point.binding,
-				obj->gl_buffer);
+			glBindBufferRange(GL_SHADER_STORAGE_BUFFER, d->bind_point.binding,
+				obj->gl_buffer, obj->gl_offset, obj->len);
 		}
 		if(obj->type == TYPE_TBO) {
 			GLenum target = get_tex_gl_target(obj->header.n_dims);
@@ -120,6 +127,7 @@ void load_dtable(uint32_t dtbl_slot, node_t* accesses) {
 }
 
 void bind_dtables() {
+	clear_bindings(BIND_DTABLES);
 	uint32_t accessed_dtables = get_accessed_dtables();
 	for(uint32_t i = 0; i < MAX_DTABLE_COUNT; i++) {
 		if(accessed_dtables & (1 << i))
@@ -0,0 +1,192 @@
+#include "../../defs.h"
+
+
+// fences are queued in submission order; the completion thread waits on them
+// from a context shared with the GL thread. RAM values are written there,
+// VRAM values are handed back to the GL thread, which owns the VRAM objects.
+pthread_mutex_t fence_mx = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t fence_cv = PTHREAD_COND_INITIALIZER;
+fence_t *pending_head, *pending_tail;
+fence_t* signalled_vram;		// completed VRAM fences, newest first
+
+semaphore_wait_t blocked_wait;	// the wait the last parked command buffer stopped at
+
+GLFWwindow* fence_window;
+pthread_t fence_thread;
+uint8_t fences_stopping;
+
+void complete_fence(fence_t* f) {
+	if(f->flags & FENCE_VRAM_BIT) {
+		pthread_mutex_lock(&fence_mx);
+		f->next = signalled_vram;
+		signalled_vram = f;
+		pthread_mutex_unlock(&fence_mx);
+		wake_gpu_thread();
+		return;
+	}
+
+	atomic_set_u64((uint64_t*)(get_ram() + f->addr), f->value);
+	if(f->flags & FENCE_IRQ_BIT)
+		fence_irq();
+	free(f);
+}
+
+void* fence_thread_func(void* args) {
+	glfwMakeContextCurrent(fence_window);
+
+	while(1) {
+		pthread_mutex_lock(&fence_mx);
+		while(!pending_head && !fences_stopping)
+			pthread_cond_wait(&fence_cv, &fence_mx);
+		if(!pending_head) {		// stopping, and every fence has signalled
+			pthread_mutex_unlock(&fence_mx);
+			break;
+		}
+		fence_t* f = pending_head;
+		pending_head = f->next;
+		if(!pending_head)
+			pending_tail = 0;
+		pthread_mutex_unlock(&fence_mx);
+
+		GLenum status;
+		do status = glClientWaitSync(f->sync, 0, FENCE_POLL_NS);
+		while(status == GL_TIMEOUT_EXPIRED);
+		if(status == GL_WAIT_FAILED)
+			WARN("fence: wait on sync object failed, signalling anyway\n");
+
+		glDeleteSync(f->sync);
+		complete_fence(f);
+	}
+
+	glfwMakeContextCurrent(NULL);
+	return NULL;
+}
+
+// shared_window must share objects with the GL thread's context and is made
+// current on the completion thread. without it, fences are polled by
+// retire_fences() on the GL thread instead, which polls while any are pending.
+void init_fences(GLFWwindow* shared_window) {
+	if(!shared_window)
+		return;
+	fence_window = shared_window;
+	pthread_create(&fence_thread, NULL, fence_thread_func, NULL);
+}
+
+// let the completion thread finish the fences already submitted and exit
+void stop_fences() {
+	if(!fence_window)
+		return;
+	pthread_mutex_lock(&fence_mx);
+	fences_stopping = 1;
+	pthread_cond_signal(&fence_cv);
+	pthread_mutex_unlock(&fence_mx);
+	pthread_join(fence_thread, NULL);
+}
+
+uint8_t check_fence_target(uint64_t addr, uint32_t flags) {
+	uint64_t capacity = (flags & FENCE_VRAM_BIT) ? VRAM_CAPACITY : RAM_CAPACITY;
+	return addr % 8 == 0 && addr + 8 <= capacity;
+}
+
+void signal_fence(uint64_t addr, uint64_t value, uint32_t flags) {
+	if(!check_fence_target(addr, flags)) {
+		WARN("fence: target address %llx misaligned or out of bounds, skipping\n", addr);
+		return;
+	}
+
+	fence_t* f = malloc(sizeof(fence_t));
+	f->addr = addr;
+	f->value = value;
+	f->flags = flags;
+	f->next = 0;
+
+	// flushed so the completion thread's wait can be satisfied
+	f->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	pthread_mutex_lock(&fence_mx);
+	if(pending_tail)
+		pending_tail->next = f;
+	else
+		pending_head = f;
+	pending_tail = f;
+	pthread_cond_signal(&fence_cv);
+	pthread_mutex_unlock(&fence_mx);
+}
+
+void poll_fences() {
+	while(1) {
+		pthread_mutex_lock(&fence_mx);
+		fence_t* f = pending_head;
+		pthread_mutex_unlock(&fence_mx);
+
+		if(!f || glClientWaitSync(f->sync, 0, 0) == GL_TIMEOUT_EXPIRED)
+			return;
+
+		pthread_mutex_lock(&fence_mx);
+		pending_head = f->next;
+		if(!pending_head)
+			pending_tail = 0;
+		pthread_mutex_unlock(&fence_mx);
+
+		glDeleteSync(f->sync);
+		complete_fence(f);
+	}
+}
+
+// whether fences are waiting to be polled by retire_fences(), which nothing
+// signals without a completion thread
+uint8_t fences_pending() {
+	if(fence_window)
+		return 0;
+	pthread_mutex_lock(&fence_mx);
+	uint8_t pending = pending_head != 0;
+	pthread_mutex_unlock(&fence_mx);
+	return pending;
+}
+
+// write the values of completed VRAM fences, called on the GL thread
+void retire_fences() {
+	if(!fence_window)
+		poll_fences();
+
+	pthread_mutex_lock(&fence_mx);
+	fence_t* f = signalled_vram;
+	signalled_vram = 0;
+	pthread_mutex_unlock(&fence_mx);
+
+	// reverse so values land in the order they were signalled
+	fence_t* ordered = 0;
+	while(f) {
+		fence_t* next = f->next;
+		f->next = ordered;
+		ordered = f;
+		f = next;
+	}
+
+	while(ordered) {
+		fence_t* next = ordered->next;
+		gpu_write(ordered->addr, (uint8_t*)&ordered->value, 8);
+		if(ordered->flags & FENCE_IRQ_BIT)
+			fence_irq();
+		free(ordered);
+		ordered = next;
+	}
+}
+
+// check whether the 64-bit timeline value at w->addr has reached w->value.
+// the value may be signalled by a fence or written by the CPU. waits on a bad
+// address are skipped.
+uint8_t semaphore_reached(semaphore_wait_t* w) {
+	if(!check_fence_target(w->addr, w->flags)) {
+		WARN("semaphore: address %llx misaligned or out of bounds, skipping\n", w->addr);
+		return 1;
+	}
+
+	uint64_t curr;
+	if(w->flags & FENCE_VRAM_BIT)
+		gpu_read((uint8_t*)&curr, w->addr, 8);
+	else
+		curr = atomic_get_u64((uint64_t*)(get_ram() + w->addr));
+	return curr >= w->value;
+}
@@ -0,0 +1,39 @@
+#ifndef FENCE_H
+#define FENCE_H
+
+#include "../../defs.h"
+
+// fence and semaphore command flags
+#define FENCE_VRAM_BIT		(1 << 0)	/* value lives in VRAM rather than RAM */
+#define FENCE_IRQ_BIT		(1 << 1)	/* raise fence_irq() once written */
+
+#define FENCE_POLL_NS		1000000		/* sync wait timeout, GPU thread wait while polling */
+#define SEMAPHORE_POLL_NS	50000		/* GPU thread wait while only parked queues have work */
+#define SEMAPHORE_WARN_NS	NS_PER_SEC
+
+// a value to write once the GL commands issued before it have completed
+typedef struct fence_t {
+	GLsync sync;
+	uint64_t addr;
+	uint64_t value;
+	uint32_t flags;
+	struct fence_t* next;
+} fence_t;
+
+// a timeline value a command buffer waits for
+typedef struct semaphore_wait_t {
+	uint64_t addr;
+	uint64_t value;
+	uint32_t flags;
+} semaphore_wait_t;
+
+void init_fences(GLFWwindow* shared_window);
+void stop_fences();
+void signal_fence(uint64_t addr, uint64_t value, uint32_t flags);
+uint8_t semaphore_reached(semaphore_wait_t* w);
+
+extern semaphore_wait_t blocked_wait;
+void retire_fences();
+uint8_t fences_pending();
+
+#endif
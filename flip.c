@@ -5,6 +5,10 @@ GLuint page_flip_fbo;
 pthread_t vblank_wait_thread;
 uint64_t curr_wait_ns, suppress_vsync_irq;
 
+// GLFW window and monitor queries are main thread only, so the main thread
+// publishes what page flips need through update_display()
+uint64_t display_w, display_h, display_refresh_rate;
+
 void* vblank_wait_func(void* args) {
 	uint64_t wait_to = atomic_get_u64(&curr_wait_ns);
 
@@ -36,6 +40,8 @@ void page_flip(uint64_t addr, uint8_t vsync_on) {
 		return;
 	}
 
+	flush_dirty(obj);
+
 	if(!page_flip_fbo)
 		glGenFramebuffers(1, &page_flip_fbo);
 
@@ -51,9 +57,9 @@ void page_flip(uint64_t addr, uint8_t vsync_on) {
 	}
 
 	// determine next vblank start time
-	GLFWmonitor* mon = glfwGetPrimaryMonitor();
-	const GLFWvidmode* mode = glfwGetVideoMode(mon);
-	int ref_rate = mode->refreshRate;
+	uint64_t ref_rate = atomic_get_u64(&display_refresh_rate);
+	if(!ref_rate)
+		ref_rate = 60;
 	struct timespec tm;
 	clock_gettime(CLOCK_MONOTONIC, &tm);
 	uint64_t interval_ns = NS_PER_SEC / ref_rate;
@@ -65,8 +71,7 @@ void page_flip(uint64_t addr, uint8_t vsync_on) {
 	glBindTexture(GL_TEXTURE_2D, obj->gl_buffer);
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, page_flip_fbo);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	int w, h;
-	glfwGetFramebufferSize(get_window(), &w, &h);
+	uint64_t w = atomic_get_u64(&display_w), h = atomic_get_u64(&display_h);
 	glBlitFramebuffer(0, obj->header.dims[1], obj->header.dims[0], 0, 0, 0,
 		w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
@@ -84,7 +89,21 @@ void page_flip(uint64_t addr, uint8_t vsync_on) {
 		page_flip_irq();
 	}
 
+	// the blit left the default framebuffer bound for drawing
+	mark_state_dirty(STATE_FBO);
+
 	glfwSwapInterval(vsync_on > 0);
 	glfwSwapBuffers(get_window());
-	glfwPollEvents();
+}
+
+// called on the main thread after processing window events
+void update_display(GLFWwindow* window) {
+	int w, h;
+	glfwGetFramebufferSize(window, &w, &h);
+	atomic_set_u64(&display_w, w);
+	atomic_set_u64(&display_h, h);
+
+	GLFWmonitor* mon = glfwGetPrimaryMonitor();
+	const GLFWvidmode* mode = mon ? glfwGetVideoMode(mon) : NULL;
+	atomic_set_u64(&display_refresh_rate, mode ? mode->refreshRate : 0);
 }
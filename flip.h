@@ -2,5 +2,6 @@
 #define FLIP_H
 
 void page_flip(uint64_t addr, uint8_t vsync_on);
+void update_display(GLFWwindow* window);
 
 #endif
@@ -0,0 +1,170 @@
+#include "../../defs.h"
+
+// the GPU thread owns the GL context. register writes are turned into
+// commands on the writer's thread and return as soon as they are queued.
+gpu_queue_t gpu_queue;
+GLFWwindow* gpu_window;
+pthread_t gpu_thread;
+
+// flips and DMA wait for the batches queued before them to complete, or to
+// park at semaphores which may only be released by work queued after them.
+// commands popped meanwhile wait behind them, in order.
+deferred_cmd_t *deferred_head, *deferred_tail;
+
+void push_gpu_cmd(gpu_cmd_t* cmd) {
+	gpu_queue_t* q = &gpu_queue;
+	uint64_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	gpu_queue_slot_t* slot;
+
+	while(1) {
+		slot = &q->slots[pos % GPU_QUEUE_SIZE];
+		uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		int64_t diff = (int64_t)(seq - pos);
+
+		if(diff == 0) {
+			if(atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else {
+			if(diff < 0)	// full, wait for the GPU thread to catch up
+				sched_yield();
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		}
+	}
+
+	slot->cmd = *cmd;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	sem_post(&q->items);
+}
+
+uint8_t pop_gpu_cmd(gpu_cmd_t* cmd) {
+	gpu_queue_t* q = &gpu_queue;
+	gpu_queue_slot_t* slot = &q->slots[q->tail % GPU_QUEUE_SIZE];
+
+	// empty, or the producer that claimed this slot has not published it yet
+	if(atomic_load_explicit(&slot->seq, memory_order_acquire) != q->tail + 1)
+		return 0;
+
+	*cmd = slot->cmd;
+	atomic_store_explicit(&slot->seq, q->tail + GPU_QUEUE_SIZE, memory_order_release);
+	q->tail++;
+	return 1;
+}
+
+// have the GPU thread look for work outside the queue, e.g. signalled fences
+void wake_gpu_thread() {
+	sem_post(&gpu_queue.items);
+}
+
+// wait for new work, or until timeout_ns passes
+void wait_gpu_work(uint64_t timeout_ns) {
+	struct timespec tm;
+	clock_gettime(CLOCK_REALTIME, &tm);
+	uint64_t ns = tm.tv_nsec + timeout_ns;
+	tm.tv_sec += ns / NS_PER_SEC;
+	tm.tv_nsec = ns % NS_PER_SEC;
+	sem_timedwait(&gpu_queue.items, &tm);
+}
+
+void exec_gpu_cmd(gpu_cmd_t* cmd) {
+	switch(cmd->type) {
+		case GPU_CMD_BATCH:
+			enqueue_batch(cmd->args[0], cmd->args[1], cmd->args[2],
+				cmd->cbos, cmd->n_cbos);
+			break;
+		case GPU_CMD_FLIP:
+			gpu_flip(cmd->args[0], cmd->args[1]);
+			break;
+		case GPU_CMD_DMA:
+			start_dma(cmd->args[0], cmd->args[1], cmd->args[2], cmd->args[3],
+				cmd->args[4]);
+			break;
+	}
+}
+
+// whether cmd can run now, rather than after batches still running
+uint8_t gpu_cmd_ready(gpu_cmd_t* cmd) {
+	return cmd->type == GPU_CMD_BATCH || !queues_runnable();
+}
+
+void run_deferred_cmds() {
+	while(deferred_head && gpu_cmd_ready(&deferred_head->cmd)) {
+		deferred_cmd_t* d = deferred_head;
+		deferred_head = d->next;
+		if(!deferred_head)
+			deferred_tail = 0;
+		exec_gpu_cmd(&d->cmd);
+		free(d);
+	}
+}
+
+void defer_gpu_cmd(gpu_cmd_t* cmd) {
+	deferred_cmd_t* d = malloc(sizeof(deferred_cmd_t));
+	d->cmd = *cmd;
+	d->next = 0;
+	if(deferred_tail)
+		deferred_tail->next = d;
+	else
+		deferred_head = d;
+	deferred_tail = d;
+}
+
+void* gpu_thread_func(void* args) {
+	glfwMakeContextCurrent(gpu_window);
+
+	// new commands are taken between command buffers so a doorbell on a
+	// higher priority queue can overtake a batch already running
+	while(1) {
+		if(queues_runnable())
+			sem_trywait(&gpu_queue.items);
+		else if(queues_busy())		// parked, CPU semaphore writes aren't signalled
+			wait_gpu_work(SEMAPHORE_POLL_NS);
+		else if(readbacks_pending())	// nothing signals them, so poll
+			wait_gpu_work(READBACK_POLL_NS);
+		else if(fences_pending())		// no completion thread to signal them
+			wait_gpu_work(FENCE_POLL_NS);
+		else
+			while(sem_wait(&gpu_queue.items));		// retry if interrupted
+
+		retire_fences();
+		retire_readbacks();
+
+		gpu_cmd_t cmd;
+		while(pop_gpu_cmd(&cmd)) {
+			if(cmd.type == GPU_CMD_QUIT) {		// work still queued is dropped
+				glfwMakeContextCurrent(NULL);
+				return NULL;
+			}
+			if(!deferred_head && gpu_cmd_ready(&cmd))
+				exec_gpu_cmd(&cmd);
+			else
+				defer_gpu_cmd(&cmd);
+			retire_fences();
+			retire_readbacks();
+		}
+
+		run_next_cbo();
+		run_deferred_cmds();
+	}
+	return NULL;
+}
+
+// window's context must not be current on the calling thread
+void start_gpu_thread(GLFWwindow* window) {
+	for(uint32_t i = 0; i < GPU_QUEUE_SIZE; i++)
+		atomic_init(&gpu_queue.slots[i].seq, i);
+	atomic_init(&gpu_queue.head, 0);
+	gpu_queue.tail = 0;
+	sem_init(&gpu_queue.items, 0, 0);
+
+	gpu_window = window;
+	pthread_create(&gpu_thread, NULL, gpu_thread_func, NULL);
+}
+
+// release the context before the window is destroyed, called on shutdown
+void stop_gpu_thread() {
+	gpu_cmd_t cmd = { .type = GPU_CMD_QUIT };
+	push_gpu_cmd(&cmd);
+	pthread_join(gpu_thread, NULL);
+	stop_fences();
+}
@@ -0,0 +1,50 @@
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include "../../defs.h"
+#include <stdatomic.h>
+#include <semaphore.h>
+
+#define GPU_QUEUE_SIZE		256		/* power of two */
+
+#define GPU_CMD_BATCH		1
+#define GPU_CMD_FLIP		2
+#define GPU_CMD_DMA			3
+#define GPU_CMD_QUIT		4
+
+// work for the GPU thread, with register values captured when it was pushed
+typedef struct gpu_cmd_t {
+	uint8_t type;
+	uint64_t args[5];		// batch: queue, priority, time queued. flip: addr,
+							// vsync. DMA: dst, src, n, control, descriptor.
+	uint64_t* cbos;			// batches only, CBO addresses copied from the ring
+	uint32_t n_cbos;
+} gpu_cmd_t;
+
+// a command popped while a flip or DMA ahead of it waits for batches
+typedef struct deferred_cmd_t {
+	gpu_cmd_t cmd;
+	struct deferred_cmd_t* next;
+} deferred_cmd_t;
+
+typedef struct gpu_queue_slot_t {
+	atomic_uint_fast64_t seq;	// position + 1 once written, free when == position
+	gpu_cmd_t cmd;
+} gpu_queue_slot_t;
+
+// bounded multi-producer single-consumer queue. producers claim a position
+// with a CAS on head and publish the slot through its sequence number; only
+// the GPU thread moves tail.
+typedef struct gpu_queue_t {
+	gpu_queue_slot_t slots[GPU_QUEUE_SIZE];
+	atomic_uint_fast64_t head;
+	uint64_t tail;
+	sem_t items;			// posted once per push, and by wake_gpu_thread()
+} gpu_queue_t;
+
+void start_gpu_thread(GLFWwindow* window);
+void stop_gpu_thread();
+void push_gpu_cmd(gpu_cmd_t* cmd);
+void wake_gpu_thread();
+
+#endif
@@ -1,28 +1,82 @@
 #include "../../defs.h"
 
-void dispatch_cmd_buffer(uint64_t addr) {
+// commands are copied here when the command buffer is aliased
+uint8_t* cmd_copy;
+uint64_t cmd_copy_capacity;
+
+// run a command buffer from op index first_op. returns CMDS_DONE, or the op to
+// resume from once a semaphore it waits for is reached.
+uint32_t dispatch_cmd_buffer(uint64_t addr, uint32_t first_op) {
 	if(addr % 256) {
 		WARN("command buffer address %llx is not 256-byte aligned, skipping\n", addr);
-		return;
+		return CMDS_DONE;
 	}
 	ref_buffer_precise(addr, TYPE_CBO, LENGTH_IN_BUFFER);
 	object_t* obj = get_object_precise(addr, TYPE_CBO, ANY_LENGTH);
 
 	if(!obj) {
 		WARN("failed to get command buffer object %llx, skipping\n", addr);
-		return;
+		return CMDS_DONE;
 	}
 
-	uint8_t* cmds = calloc(1, obj->len);
-	gpu_read(cmds, addr, obj->len);
+	// optimal case: CBOs have no GL storage, so with no other object in the
+	// range VRAM holds the commands. they are decoded in place and cached.
+	uint32_t stop;
+	if(count_region(addr, obj->len) == 1)
+		stop = exec_commands(get_cached_commands(obj), first_op);
+	else {
+		if(obj->len > cmd_copy_capacity) {
+			cmd_copy = realloc(cmd_copy, obj->len);
+			cmd_copy_capacity = obj->len;
+		}
+		uint8_t* cmds = gpu_read(cmd_copy, addr, obj->len);
+		stop = command_decoder(cmds + obj->header_len, obj->header.n_cmd_bytes,
+			first_op);
+	}
 
-	command_decoder(cmds + obj->header_len, obj->header.n_cmd_bytes);
+	sync_overlaps();
+	return stop;
+}
 
-	destroy_all_overlaps();
-	free(cmds);
+uint64_t now_ns() {
+	struct timespec tm;
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return tm.tv_sec * NS_PER_SEC + tm.tv_nsec;
 }
 
-void process_batch(uint64_t ring_addr, uint64_t read_ptr, uint64_t read_len) {
+// queue 0 uses the original queue registers, the others a register set each
+typedef struct queue_regs_t {
+	uint32_t* ctrl;
+	uint64_t* ring_addr;
+	uint64_t* read_ptr;
+	uint64_t* read_len;
+	uint32_t* ring_size;
+} queue_regs_t;
+
+void get_queue_regs(uint32_t queue, queue_regs_t* r) {
+	uint8_t* ram = get_ram();
+	if(!queue) {
+		r->ctrl			= (uint32_t*)&ram[GPU_CTRL_REG];
+		r->ring_addr	= (uint64_t*)&ram[QUEUE_ADDR_REG];
+		r->read_ptr		= (uint64_t*)&ram[QUEUE_READ_PTR_REG];
+		r->read_len		= (uint64_t*)&ram[QUEUE_READ_LEN_REG];
+		r->ring_size	= (uint32_t*)&ram[QUEUE_SIZE_REG];
+		return;
+	}
+
+	uint8_t* set = &ram[QUEUE_SETS_BASE + (queue - 1) * QUEUE_SET_STRIDE];
+	r->ctrl			= (uint32_t*)(set + QUEUE_SET_CTRL);
+	r->ring_addr	= (uint64_t*)(set + QUEUE_SET_ADDR);
+	r->read_ptr		= (uint64_t*)(set + QUEUE_SET_READ_PTR);
+	r->read_len		= (uint64_t*)(set + QUEUE_SET_READ_LEN);
+	r->ring_size	= (uint32_t*)(set + QUEUE_SET_SIZE);
+}
+
+// copy the batch out of the DMA ring. the read pointer moves past it as soon
+// as the doorbell is taken, so the ring entries may be reused before the GPU
+// thread gets to them.
+void queue_batch(uint32_t queue, uint8_t priority, uint64_t ring_addr,
+	uint64_t ring_size, uint64_t read_ptr, uint64_t read_len) {
 	if(read_len == 0) {
 		WARN("read length for batch is 0, skipping\n");
 		return;
@@ -31,79 +85,92 @@ void process_batch(uint64_t ring_addr, uint64_t read_ptr, uint64_t read_len) {
 		WARN("read length %llx for batch is not a multiple of 8, skipping\n", read_len);
 		return;
 	}
+	if(read_len > ring_size) {
+		WARN("read length %llx for batch is larger than the DMA ring, skipping\n", read_len);
+		return;
+	}
 
-	uint64_t ring_end = ring_addr + 16384 - 1;
+	uint64_t ring_end = ring_addr + ring_size - 1;
 	if(read_ptr < ring_addr || read_ptr > ring_end) {
 		WARN("read pointer %llx for batch is not within DMA ring bounds [%llx, %llx], skipping\n",
 				read_ptr, ring_addr, ring_end);
 		return;
 	}
 
-	uint64_t* batch = calloc(1, read_len);
-	uint64_t overflow = (read_ptr + read_len > ring_end) ?
-		read_ptr + read_len - ring_end : 0;
-
-	memcpy(batch, &get_ram()[read_ptr], read_len - overflow);
-	memcpy(batch + overflow, &get_ram()[ring_addr], overflow);
-
-	for(uint32_t i = 0; i < read_len / 8; i++)
-		dispatch_cmd_buffer(batch[i]);
-
-	free(batch);
+	// the batch wraps around to the start of the ring
+	uint64_t overflow = (read_ptr + read_len - 1 > ring_end) ?
+		read_ptr + read_len - 1 - ring_end : 0;
+
+	gpu_cmd_t cmd = { .type = GPU_CMD_BATCH };
+	cmd.args[0] = queue;
+	cmd.args[1] = priority;
+	cmd.args[2] = now_ns();
+	cmd.cbos = malloc(read_len);
+	cmd.n_cbos = read_len / 8;
+	memcpy(cmd.cbos, &get_ram()[read_ptr], read_len - overflow);
+	memcpy((uint8_t*)cmd.cbos + read_len - overflow, &get_ram()[ring_addr], overflow);
+	push_gpu_cmd(&cmd);
+}
 
-	glFinish();
+uint8_t doorbell_rung() {
+	queue_regs_t r;
+	for(uint32_t i = 0; i < GPU_QUEUE_COUNT; i++) {
+		get_queue_regs(i, &r);
+		if(*r.ctrl & DOORBELL_BIT)
+			return 1;
+	}
+	return 0;
 }
 
 void issue_batch() {
-	uint32_t* ctrl 		= (uint32_t*)&get_ram()[GPU_CTRL_REG];
-	uint64_t* ring_addr	= (uint64_t*)&get_ram()[QUEUE_ADDR_REG];
-	uint64_t* read_ptr	= (uint64_t*)&get_ram()[QUEUE_READ_PTR_REG];
-	uint64_t* read_len	= (uint64_t*)&get_ram()[QUEUE_READ_LEN_REG];
-
-	if(!(*ctrl & DOORBELL_BIT))
-		return;
-
-	uint64_t old_read_ptr = *read_ptr;
-	*read_ptr += *read_len;
-	*ctrl &= ~DOORBELL_BIT;
-	if(*ring_addr % 16384) {
-		WARN("DMA ring address %llx misaligned, skip doorbell ring\n", *ring_addr);
-		return;
-	}
-	if(*ring_addr + 16384 - 1 >= RAM_CAPACITY) {
-		WARN("DMA ring address %llx out of bounds, skip doorbell ring\n", *ring_addr);
-		return;
+	queue_regs_t r;
+	for(uint32_t i = 0; i < GPU_QUEUE_COUNT; i++) {
+		get_queue_regs(i, &r);
+		if(!(*r.ctrl & DOORBELL_BIT))
+			continue;
+
+		uint64_t old_read_ptr = *r.read_ptr;
+		*r.read_ptr += *r.read_len;
+		*r.ctrl &= ~DOORBELL_BIT;
+
+		uint64_t ring_size = *r.ring_size ? *r.ring_size : DEFAULT_RING_SIZE;
+		if(ring_size < MIN_RING_SIZE || ring_size > MAX_RING_SIZE ||
+			(ring_size & (ring_size - 1))) {
+			WARN("queue %u ring size %llx invalid, skip doorbell ring\n", i, ring_size);
+			continue;
+		}
+		if(*r.ring_addr % ring_size) {
+			WARN("queue %u DMA ring address %llx misaligned, skip doorbell ring\n",
+				i, *r.ring_addr);
+			continue;
+		}
+		if(*r.ring_addr + ring_size - 1 >= RAM_CAPACITY) {
+			WARN("queue %u DMA ring address %llx out of bounds, skip doorbell ring\n",
+				i, *r.ring_addr);
+			continue;
+		}
+
+		queue_batch(i, GET_QUEUE_PRIORITY(*r.ctrl), *r.ring_addr, ring_size,
+			old_read_ptr, *r.read_len);
 	}
-
-	process_batch(*ring_addr, old_read_ptr, *read_len);
 }
 
 void gpu_registers_update(void* cpu, uint64_t start, uint64_t length) {
-	uint32_t* ctrl 		= (uint32_t*)&get_ram()[GPU_CTRL_REG];
 	uint32_t* scan_ctrl	= (uint32_t*)&get_ram()[SCANOUT_CTRL_REG];
 	uint64_t* scan_tbo	= (uint64_t*)&get_ram()[SCANOUT_TBO_ADDR_REG];
-	uint32_t* copy_r	= (uint32_t*)&get_ram()[READ_CTRL_REG];
-	uint32_t* copy_w	= (uint32_t*)&get_ram()[WRITE_CTRL_REG];
-
-	if(*copy_r & REQUEST_READ_BIT) {
-		uint64_t dst = *(uint64_t*)(get_ram() + READ_DST_ADDR_REG);
-		uint64_t src = *(uint64_t*)(get_ram() + READ_SRC_ADDR_REG);
-		uint64_t n   = *(uint64_t*)(get_ram() + READ_LEN_REG);
-		request_read(dst, src, n);
-	}
 
-	if(*copy_w & REQUEST_WRITE_BIT) {
-		uint64_t dst = *(uint64_t*)(get_ram() + WRITE_DST_ADDR_REG);
-		uint64_t src = *(uint64_t*)(get_ram() + WRITE_SRC_ADDR_REG);
-		uint64_t n   = *(uint64_t*)(get_ram() + WRITE_LEN_REG);
-		request_write(dst, src, n);
-	}
+	// requests are queued for the GPU thread with the register values as
+	// they are now, and complete through their IRQs
+	take_dma_descriptors();
 
-	if(*ctrl & DOORBELL_BIT)
+	if(doorbell_rung())
 		gpu_batch();
 
 	if(*scan_ctrl & PAGE_FLIP_BIT) {
 		*scan_ctrl &= ~PAGE_FLIP_BIT;
-		gpu_flip(*scan_tbo, (*scan_ctrl & VSYNC_ON_BIT) > 0);
+		gpu_cmd_t cmd = { .type = GPU_CMD_FLIP };
+		cmd.args[0] = *scan_tbo;
+		cmd.args[1] = (*scan_ctrl & VSYNC_ON_BIT) > 0;
+		push_gpu_cmd(&cmd);
 	}
 }
@@ -5,11 +5,14 @@
 
 void gpu_registers_update(void*, uint64_t, uint64_t);
 void issue_batch();
+uint32_t dispatch_cmd_buffer(uint64_t addr, uint32_t first_op);
+uint64_t now_ns();
 
 // defined externally
 void page_flip_irq();
 void dma_read_complete_irq();
 void dma_write_complete_irq();
+void fence_irq();
 void gpu_flip(uint64_t, uint8_t);
 void gpu_batch();
 
@@ -17,14 +20,32 @@ void gpu_batch();
 #define WARN(...) printf(__VA_ARGS__)
 #define LOG(...) printf(__VA_ARGS__)
 
+// build with -DGPU_STATS to log per-batch statistics
+#ifdef GPU_STATS
+#define STATS(...) LOG(__VA_ARGS__)
+#else
+#define STATS(...)
+#endif
+
 #include "mem.h"
+#include "itree.h"
+#include "pool.h"
+#include "range.h"
 #include "buffer.h"
+#include "store.h"
+#include "overlap.h"
 #include "texture.h"
 #include "dtable.h"
 #include "kernel.h"
 #include "commands.h"
+#include "cmdcache.h"
 #include "flip.h"
 #include "copy.h"
+#include "readback.h"
+#include "transfer.h"
+#include "fence.h"
+#include "frontend.h"
+#include "hwqueue.h"
 
 #define GPU_REGS_LOW  0x26000
 #define GPU_REGS_HIGH 0x26FFF
@@ -38,24 +59,27 @@ void gpu_batch();
 #define QUEUE_READ_LEN_REG		0x26024
 #define SCANOUT_CTRL_REG		0x2602C
 #define SCANOUT_TBO_ADDR_REG	0x26030
-#define READ_CTRL_REG			0x26038
-#define READ_DST_ADDR_REG		0x2603C
-#define READ_SRC_ADDR_REG		0x26044
-#define READ_LEN_REG			0x2604C
-#define WRITE_CTRL_REG			0x26054
-#define WRITE_DST_ADDR_REG		0x26058
-#define WRITE_SRC_ADDR_REG		0x26060
-#define WRITE_LEN_REG			0x26068
-
-// GPU control register flags
+#define DMA_RING_ADDR_REG		0x26038		/* RAM address of the descriptor ring */
+#define DMA_RING_SIZE_REG		0x26040		/* descriptors, power of two */
+#define DMA_TAIL_REG			0x26044		/* descriptors submitted by the CPU */
+#define DMA_HEAD_REG			0x26048		/* descriptors taken by the GPU */
+#define QUEUE_SIZE_REG			0x26070		/* queue 0 ring size, 0 for 16 KB */
+
+// register sets of queues 1 to GPU_QUEUE_COUNT - 1. each has the fields of
+// queue 0's GPU_CTRL_REG and QUEUE_*_REG registers.
+#define QUEUE_SETS_BASE			0x26100
+#define QUEUE_SET_STRIDE		0x40
+#define QUEUE_SET_CTRL			0x0
+#define QUEUE_SET_ADDR			0x4
+#define QUEUE_SET_READ_PTR		0xC
+#define QUEUE_SET_READ_LEN		0x14
+#define QUEUE_SET_SIZE			0x1C
+
+// GPU control register flags, also used by QUEUE_SET_CTRL
 #define DOORBELL_BIT (1 << 31)
 
 // scanout control register flags
 #define PAGE_FLIP_BIT (1 << 31)
 #define VSYNC_ON_BIT (1 << 30)
 
-// copy control register flags
-#define REQUEST_READ_BIT (1 << 31)
-#define REQUEST_WRITE_BIT (1 << 31)
-
 #endif
@@ -0,0 +1,156 @@
+#include "../../defs.h"
+
+// batches from all queues are interleaved one command buffer at a time. the
+// highest priority queue with work goes first, equal priorities take turns.
+// a queue parked at a semaphore wait is passed over until the value is reached,
+// so the wait can be satisfied by fences signalled from the other queues.
+hw_queue_t hw_queues[GPU_QUEUE_COUNT];
+uint32_t last_queue;
+uint32_t regs_queue;		// queue whose registers are in cmd_regs
+
+void enqueue_batch(uint32_t queue, uint8_t priority, uint64_t queued_ns,
+	uint64_t* cbos, uint32_t n_cbos) {
+	batch_t* b = calloc(1, sizeof(batch_t));
+	b->cbos = cbos;
+	b->n_cbos = n_cbos;
+	b->priority = priority;
+	b->queued_ns = queued_ns;
+
+	hw_queue_t* q = &hw_queues[queue];
+	if(q->tail)
+		q->tail->next_batch = b;
+	else
+		q->head = b;
+	q->tail = b;
+}
+
+uint8_t queues_busy() {
+	for(uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+		if(hw_queues[i].head)
+			return 1;
+	return 0;
+}
+
+// whether a batch can be dispatched, i.e. isn't parked or its wait is over
+uint8_t batch_ready(batch_t* b) {
+	if(!b->parked || semaphore_reached(&b->wait))
+		return 1;
+
+	if(!b->warned && now_ns() - b->parked_ns > SEMAPHORE_WARN_NS) {
+		WARN("semaphore: still waiting for %llx to reach %llu\n", b->wait.addr,
+			b->wait.value);
+		b->warned = 1;
+	}
+	return 0;
+}
+
+uint32_t pick_queue() {
+	uint32_t best = GPU_QUEUE_COUNT;
+	for(uint32_t n = 1; n <= GPU_QUEUE_COUNT; n++) {
+		uint32_t i = (last_queue + n) % GPU_QUEUE_COUNT;
+		if(!hw_queues[i].head || !batch_ready(hw_queues[i].head))
+			continue;
+		if(best == GPU_QUEUE_COUNT ||
+			hw_queues[i].head->priority > hw_queues[best].head->priority)
+			best = i;
+	}
+	return best;
+}
+
+// queued work that isn't parked, see pick_queue()
+uint8_t queues_runnable() {
+	return pick_queue() != GPU_QUEUE_COUNT;
+}
+
+void complete_batch(uint32_t queue) {
+	hw_queue_t* q = &hw_queues[queue];
+	batch_t* b = q->head;
+	q->head = b->next_batch;
+	if(!q->head)
+		q->tail = 0;
+	q->stats.batches++;
+	free(b->cbos);
+	free(b);
+
+	flush_all_dirty();
+
+#ifdef GPU_STATS
+	queue_stats_t* s = &q->stats;
+	STATS("queue %u: %llu batches, %llu CBOs, %llu us busy, %llu us waiting, "
+		"%llu preemptions, %llu parks\n", queue, s->batches, s->cbos,
+		s->busy_ns / 1000, s->wait_ns / 1000, s->preemptions, s->parks);
+	alloc_stats_t* a = get_alloc_stats();
+	STATS("batch allocs: %llu objects (%llu freed, %llu slabs), "
+		"%llu vector grows (%llu freed)\n", a->obj_allocs, a->obj_frees,
+		a->slab_allocs, a->vec_grows, a->vec_frees);
+	draw_stats_t* d = get_draw_stats();
+	STATS("batch draws: %llu in %llu GL calls\n", d->draws, d->gl_draw_calls);
+	cmd_cache_stats_t* c = get_cmd_cache_stats();
+	STATS("command cache: %llu hits, %llu misses\n", c->hits, c->misses);
+	readback_stats_t* r = get_readback_stats();
+	STATS("readbacks: %llu async (%llu bytes, %llu us average latency, %llu forced), "
+		"%llu stalled\n", r->async, r->bytes,
+		r->landed ? r->latency_ns / r->landed / 1000 : 0, r->forced, r->sync);
+#endif
+	reset_alloc_stats();
+	reset_draw_stats();
+	reset_readback_stats();
+
+	// submit without waiting, completion is observed through fences
+	glFlush();
+}
+
+// make cmd_regs hold the registers of queue. everything derived from the
+// previous queue's registers is rebuilt at its next use.
+void switch_regs(uint32_t queue) {
+	if(queue == regs_queue)
+		return;
+	memcpy(hw_queues[regs_queue].regs, cmd_regs, NUM_BYTES_CMD_REGS);
+	memcpy(cmd_regs, hw_queues[queue].regs, NUM_BYTES_CMD_REGS);
+	regs_queue = queue;
+	mark_state_dirty(STATE_ALL);
+}
+
+// dispatch one command buffer from the queue that should run next
+void run_next_cbo() {
+	uint32_t queue = pick_queue();
+	if(queue == GPU_QUEUE_COUNT)
+		return;
+
+	batch_t* last = hw_queues[last_queue].head;
+	if(queue != last_queue && last && last->next && !last->parked)
+		hw_queues[last_queue].stats.preemptions++;
+	last_queue = queue;
+
+	hw_queue_t* q = &hw_queues[queue];
+	batch_t* b = q->head;
+	uint64_t start = now_ns();
+	if(!b->next && !b->parked)
+		q->stats.wait_ns += start - b->queued_ns;
+
+	switch_regs(queue);
+	uint32_t stop = dispatch_cmd_buffer(b->cbos[b->next], b->resume_op);
+	q->stats.busy_ns += now_ns() - start;
+
+	// the rest of the CBO runs once the wait is reached
+	if(stop != CMDS_DONE) {
+		b->resume_op = stop;
+		b->parked = 1;
+		b->warned = 0;
+		b->wait = blocked_wait;
+		b->parked_ns = now_ns();
+		q->stats.parks++;
+		return;
+	}
+	b->resume_op = 0;
+	b->parked = 0;
+	b->next++;
+	q->stats.cbos++;
+
+	if(b->next == b->n_cbos)
+		complete_batch(queue);
+}
+
+queue_stats_t* get_queue_stats(uint32_t queue) {
+	return &hw_queues[queue].stats;
+}
@@ -0,0 +1,54 @@
+#ifndef HWQUEUE_H
+#define HWQUEUE_H
+
+#include "../../defs.h"
+
+#define GPU_QUEUE_COUNT		4
+#define DEFAULT_RING_SIZE	16384
+#define MIN_RING_SIZE		256
+#define MAX_RING_SIZE		0x100000
+
+// GPU_CTRL_REG and QUEUE_SET_CTRL fields
+#define GET_QUEUE_PRIORITY(x)	((x) & 0x3)		/* 3 is served first */
+
+// CBO addresses copied out of a ring by one doorbell
+typedef struct batch_t {
+	uint64_t* cbos;
+	uint32_t n_cbos;
+	uint32_t next;			// index of the next CBO to dispatch
+	uint32_t resume_op;		// op of CBO next to continue from, if parked
+	uint8_t parked;			// stopped at a semaphore wait that isn't reached
+	uint8_t warned;
+	semaphore_wait_t wait;
+	uint64_t parked_ns;
+	uint8_t priority;
+	uint64_t queued_ns;		// when the doorbell was taken
+	struct batch_t* next_batch;
+} batch_t;
+
+typedef struct queue_stats_t {
+	uint64_t batches;		// batches completed
+	uint64_t cbos;			// command buffers dispatched
+	uint64_t busy_ns;		// time spent dispatching them
+	uint64_t wait_ns;		// doorbell to first dispatch, summed over batches
+	uint64_t preemptions;	// times a part-done batch was set aside for another queue
+	uint64_t parks;			// times a batch stopped at a semaphore wait
+} queue_stats_t;
+
+// each queue has its own command register context, swapped into cmd_regs
+// while its command buffers run
+typedef struct hw_queue_t {
+	batch_t* head;
+	batch_t* tail;
+	uint8_t regs[NUM_BYTES_CMD_REGS];	// saved while another queue runs
+	queue_stats_t stats;
+} hw_queue_t;
+
+void enqueue_batch(uint32_t queue, uint8_t priority, uint64_t queued_ns,
+	uint64_t* cbos, uint32_t n_cbos);
+uint8_t queues_busy();
+uint8_t queues_runnable();
+void run_next_cbo();
+queue_stats_t* get_queue_stats(uint32_t queue);
+
+#endif
@@ -0,0 +1,145 @@
+#include "../../defs.h"
+
+int32_t itree_height(itree_node_t* node) {
+	return node ? node->height : 0;
+}
+
+void itree_update(itree_node_t* node) {
+	int32_t lh = itree_height(node->left), rh = itree_height(node->right);
+	node->height = 1 + (lh > rh ? lh : rh);
+
+	node->max_end = node->end;
+	if(node->left && node->left->max_end > node->max_end)
+		node->max_end = node->left->max_end;
+	if(node->right && node->right->max_end > node->max_end)
+		node->max_end = node->right->max_end;
+}
+
+// order by start address, ties broken by node address
+uint8_t itree_less(itree_node_t* a, itree_node_t* b) {
+	if(a->start != b->start)
+		return a->start < b->start;
+	return (uintptr_t)a < (uintptr_t)b;
+}
+
+itree_node_t* itree_rotate_left(itree_node_t* node) {
+	itree_node_t* r = node->right;
+	node->right = r->left;
+	r->left = node;
+	itree_update(node);
+	itree_update(r);
+	return r;
+}
+
+itree_node_t* itree_rotate_right(itree_node_t* node) {
+	itree_node_t* l = node->left;
+	node->left = l->right;
+	l->right = node;
+	itree_update(node);
+	itree_update(l);
+	return l;
+}
+
+itree_node_t* itree_balance(itree_node_t* node) {
+	itree_update(node);
+	int32_t balance = itree_height(node->left) - itree_height(node->right);
+
+	if(balance > 1) {
+		if(itree_height(node->left->left) < itree_height(node->left->right))
+			node->left = itree_rotate_left(node->left);
+		return itree_rotate_right(node);
+	}
+	if(balance < -1) {
+		if(itree_height(node->right->right) < itree_height(node->right->left))
+			node->right = itree_rotate_right(node->right);
+		return itree_rotate_left(node);
+	}
+	return node;
+}
+
+itree_node_t* itree_insert_at(itree_node_t* root, itree_node_t* node) {
+	if(!root)
+		return node;
+	if(itree_less(node, root))
+		root->left = itree_insert_at(root->left, node);
+	else
+		root->right = itree_insert_at(root->right, node);
+	return itree_balance(root);
+}
+
+void itree_insert(itree_node_t** root, itree_node_t* node) {
+	node->left = node->right = 0;
+	node->height = 1;
+	node->max_end = node->end;
+	*root = itree_insert_at(*root, node);
+}
+
+// detach the leftmost node of the subtree into *min
+itree_node_t* itree_remove_min(itree_node_t* root, itree_node_t** min) {
+	if(!root->left) {
+		*min = root;
+		return root->right;
+	}
+	root->left = itree_remove_min(root->left, min);
+	return itree_balance(root);
+}
+
+itree_node_t* itree_remove_at(itree_node_t* root, itree_node_t* node) {
+	if(!root)
+		ERROR("itree_remove(): node not found in tree\n");
+
+	if(root == node) {
+		if(!node->left)
+			return node->right;
+		if(!node->right)
+			return node->left;
+
+		itree_node_t* min;
+		itree_node_t* right = itree_remove_min(node->right, &min);
+		min->left = node->left;
+		min->right = right;
+		return itree_balance(min);
+	}
+
+	if(itree_less(node, root))
+		root->left = itree_remove_at(root->left, node);
+	else
+		root->right = itree_remove_at(root->right, node);
+	return itree_balance(root);
+}
+
+void itree_remove(itree_node_t** root, itree_node_t* node) {
+	*root = itree_remove_at(*root, node);
+	node->left = node->right = 0;
+}
+
+// in-order walk calling visit() on every node overlapping [start, end]
+void itree_query(itree_node_t* root, uint64_t start, uint64_t end,
+	itree_visit_t visit, void* arg) {
+	if(!root || root->max_end < start)
+		return;
+
+	itree_query(root->left, start, end, visit, arg);
+
+	if(root->start > end)	// right subtree starts even later
+		return;
+
+	if(root->end >= start)
+		visit(root, arg);
+
+	itree_query(root->right, start, end, visit, arg);
+}
+
+// get number of nodes overlapping [start, end]
+uint32_t itree_count(itree_node_t* root, uint64_t start, uint64_t end) {
+	if(!root || root->max_end < start)
+		return 0;
+
+	uint32_t count = itree_count(root->left, start, end);
+	if(root->start > end)
+		return count;
+
+	if(root->end >= start)
+		count++;
+	return count + itree_count(root->right, start, end);
+}
@@ -0,0 +1,25 @@
+#ifndef ITREE_H
+#define ITREE_H
+
+#include "../../defs.h"
+
+// node of an augmented AVL interval tree. nodes are embedded in the structure
+// they index and ordered by (start, node address) so equal starts are allowed.
+typedef struct itree_node_t {
+	uint64_t start, end;	// inclusive range
+	uint64_t max_end;		// largest end in this subtree
+	int32_t height;
+	void* data;
+	struct itree_node_t* left;
+	struct itree_node_t* right;
+} itree_node_t;
+
+typedef void (*itree_visit_t)(itree_node_t* node, void* arg);
+
+void itree_insert(itree_node_t** root, itree_node_t* node);
+void itree_remove(itree_node_t** root, itree_node_t* node);
+void itree_query(itree_node_t* root, uint64_t start, uint64_t end,
+	itree_visit_t visit, void* arg);
+uint32_t itree_count(itree_node_t* root, uint64_t start, uint64_t end);
+
+#endif
@@ -2,6 +2,14 @@
 
 kernel_info_t* bound_kernel;
 
+// uniform register snapshots are streamed through a ring, split in segments
+// that are recycled once fences show the GPU finished reading them
+GLuint uregs_ring;
+uint8_t* uregs_ring_map;	// persistent mapping, if buffer storage is available
+uint64_t uregs_offset;		// where the next snapshot goes
+GLint uregs_align;
+GLsync uregs_fences[UREGS_RING_SEGMENTS];
+
 node_t* get_accesses() {
 	return bound_kernel ? bound_kernel->desc_accesses : 0;
 }
@@ -55,8 +63,13 @@ void free_list(node_t* node) {
 
 void free_kernel(object_t* obj) {
 	kernel_info_t* info = obj->kernel_info;
+	if(!info)
+		return;
+	if(info == bound_kernel) {
+		bound_kernel = 0;
+		mark_state_dirty(STATE_KERNEL);		// rebind at the next draw
+	}
 	glDeleteProgram(info->gl_program);
-	glDeleteBuffers(1, &info->gl_uregs_ubo);
 	free_list(info->desc_accesses);
 	free(info);
 }
@@ -769,10 +782,6 @@ void build_kernel(object_t* obj) {
 		free(name.str);
 	}
 
-	glGenBuffers(1, &info.gl_uregs_ubo);
-	glBindBuffer(GL_UNIFORM_BUFFER, info.gl_uregs_ubo);
-	glBufferData(GL_UNIFORM_BUFFER, 128, NULL, GL_STATIC_DRAW);
-
 	obj->kernel_info = malloc(sizeof(kernel_info_t));
 	memcpy(obj->kernel_info, &info, sizeof(kernel_info_t));
 }
@@ -797,19 +806,85 @@ void bind_kernel() {
 		load_uregs();
 
 		GLuint idx = glGetUniformBlockIndex(bound_kernel->gl_program, "uregs_ubo");
-		if(idx != GL_INVALID_INDEX) {
+		if(idx != GL_INVALID_INDEX)
 			glUniformBlockBinding(bound_kernel->gl_program, idx, 0);
-			glBindBufferBase(GL_UNIFORM_BUFFER, 0, bound_kernel->gl_uregs_ubo);
+	}
+}
+
+void create_uregs_ring() {
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uregs_align);
+	if(uregs_align < UREGS_SIZE)
+		uregs_align = UREGS_SIZE;
+
+	glGenBuffers(1, &uregs_ring);
+	glBindBuffer(GL_UNIFORM_BUFFER, uregs_ring);
+
+	if(use_persistent_buffers()) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT
+			| GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, UREGS_RING_SIZE, 0, flags);
+		uregs_ring_map = glMapBufferRange(GL_UNIFORM_BUFFER, 0, UREGS_RING_SIZE, flags);
+		if(!uregs_ring_map)
+			ERROR("failed to map uniform register ring\n");
+	} else
+		glBufferData(GL_UNIFORM_BUFFER, UREGS_RING_SIZE, 0, GL_STREAM_DRAW);
+}
+
+// get the ring offset for the next snapshot, waiting for the GPU to finish
+// with a segment before it is reused
+uint64_t alloc_uregs() {
+	uint64_t segment_size = UREGS_RING_SIZE / UREGS_RING_SEGMENTS;
+	if(uregs_offset + UREGS_SIZE > UREGS_RING_SIZE)
+		uregs_offset = 0;
+
+	uint32_t segment = uregs_offset / segment_size;
+	uint32_t end_segment = (uregs_offset + UREGS_SIZE - 1) / segment_size;
+	if(segment != end_segment) {		// snapshots don't straddle segments
+		uregs_offset = end_segment * segment_size;
+		segment = end_segment;
+	}
+
+	if(uregs_offset % segment_size == 0) {
+		// fence the segment just filled, then wait on the one being entered
+		uint32_t prev = (segment + UREGS_RING_SEGMENTS - 1) % UREGS_RING_SEGMENTS;
+		if(uregs_fences[prev])
+			glDeleteSync(uregs_fences[prev]);
+		uregs_fences[prev] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		if(uregs_fences[segment]) {
+			while(glClientWaitSync(uregs_fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT,
+				NS_PER_SEC) == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(uregs_fences[segment]);
+			uregs_fences[segment] = 0;
 		}
 	}
+
+	uint64_t offset = uregs_offset;
+	uregs_offset += uregs_align;
+	return offset;
 }
 
+// append a snapshot of the uniform registers to the ring and bind it for the
+// bound kernel. called at draw time, when the registers changed.
 void load_uregs() {
 	if(!bound_kernel)
 		return;
-	uint8_t* data = malloc(128);
-	memcpy(data, cmd_regs + UNIFORM_0_REG, 128);
-	glBindBuffer(GL_UNIFORM_BUFFER, bound_kernel->gl_uregs_ubo);
-	glBufferData(GL_UNIFORM_BUFFER, 128, data, GL_STATIC_DRAW);
-	free(data);
+	if(!uregs_ring)
+		create_uregs_ring();
+
+	uint64_t offset = alloc_uregs();
+	uint8_t* src = cmd_regs + UNIFORM_0_REG;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, uregs_ring);
+	if(uregs_ring_map)
+		memcpy(uregs_ring_map + offset, src, UREGS_SIZE);
+	else {
+		// fences keep the GPU off this range, so skip the driver's sync
+		uint8_t* dst = glMapBufferRange(GL_UNIFORM_BUFFER, offset, UREGS_SIZE,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		memcpy(dst, src, UREGS_SIZE);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	}
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, uregs_ring, offset, UREGS_SIZE);
 }
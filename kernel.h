@@ -9,6 +9,10 @@
 #define MAX_UBO_COUNT	32
 #define MAX_TBO_COUNT	16
 
+#define UREGS_SIZE			128			/* bytes of uniform registers */
+#define UREGS_RING_SIZE		(256 * 1024)
+#define UREGS_RING_SEGMENTS	4
+
 #define N_OPS	6
 #define OP_MOV	0
 #define OP_ULD	1
@@ -49,7 +53,6 @@ typedef struct attrib_access_t {
 
 typedef struct kernel_info_t {
 	GLuint gl_program;
-	GLuint gl_uregs_ubo;
 	uint32_t table_accesses;
 	node_t* desc_accesses;
 
@@ -10,6 +10,7 @@ void gpu_batch()						{ issue_batch(); }
 void page_flip_irq()					{};
 void dma_read_complete_irq()			{};
 void dma_write_complete_irq()			{};
+void fence_irq()						{};
 
 GLFWwindow* get_window() {
 	return window;
@@ -54,20 +55,32 @@ void init_glfw() {
 	if(!window)
 		ERROR("failed to create window\n");
 
+	// hidden context sharing the window's objects, used to wait on fences
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* fence_window = glfwCreateWindow(1, 1, "", NULL, window);
+	if(!fence_window)
+		WARN("failed to create fence context, fences are polled per batch\n");
+	init_fences(fence_window);
+
 	glfwMakeContextCurrent(window);
 	glClearColor(0., 0., 0., 1.);
 	glClear(GL_COLOR_BUFFER_BIT);
 	glfwSwapBuffers(window);
+	update_display(window);
+
+	// the GPU thread takes over the context
+	glfwMakeContextCurrent(NULL);
+	start_gpu_thread(window);
 }
 
 int main() {
 	init_glfw();
 	LOG("initialized OpenGL\n");
 	while(!glfwWindowShouldClose(window)) {
-		object_t* obj = ref_buffer_precise(0, TYPE_VBO, 5);
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		glfwWaitEvents();
+		update_display(window);
 	}
+	stop_gpu_thread();
 	glfwTerminate();
 	return 0;
 }
@@ -5,28 +5,49 @@ uint8_t vram[VRAM_CAPACITY];
 #define MATCH_LOWEST 0
 #define MATCH_HIGHEST 1
 
-object_t* next_object(uint64_t addr, uint64_t search_len, object_t* exclude_obj, uint8_t match_refcount) {
+// get number of hits in q overlapping [addr, addr + len - 1] and the first one
+uint32_t count_hits(region_query_t* q, uint64_t addr, uint64_t len, object_t** first) {
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < q->count; i++) {
+		object_t* obj = q->hits[i].obj;
+		if(obj->addr > addr + len - 1)
+			break;		// hits are sorted by address
+		if(!check_overlap(obj->addr, obj->addr + obj->len - 1, addr, addr + len - 1))
+			continue;
+		if(!count && first)
+			*first = obj;
+		count++;
+	}
+	return count;
+}
+
+object_t* next_object(region_query_t* q, uint64_t addr, uint64_t search_len, region_hit_t* exclude, uint8_t match_refcount) {
 	object_t* next_obj = 0;
 
 	uint64_t min_addr = UINT64_MAX;	// want first object
 	int64_t best_refcount = match_refcount == MATCH_LOWEST ? INT64_MAX : INT64_MIN;
-	uint32_t count = get_region_object_count(addr, search_len);
-	for(uint32_t i = 0; i < count; i++) {
-		object_t* obj = get_region_object_list(i, addr, search_len);
+	for(uint32_t i = 0; i < q->count; i++) {
+		region_hit_t* hit = &q->hits[i];
+		object_t* obj = hit->obj;
 
-		if(obj == exclude_obj)
+		if(obj->addr > addr + search_len - 1)
+			break;
+		if(!check_overlap(obj->addr, obj->addr + obj->len - 1, addr, addr + search_len - 1))
+			continue;
+
+		if(exclude && obj == exclude->obj)
 			continue;
 
 		// require better refcount than excluded for portion cut-off
-		if(exclude_obj) {
-			if((match_refcount == MATCH_LOWEST  && obj->refcount > exclude_obj->refcount)
-			|| (match_refcount == MATCH_HIGHEST && obj->refcount < exclude_obj->refcount))
+		if(exclude) {
+			if((match_refcount == MATCH_LOWEST  && hit->refcount > exclude->refcount)
+			|| (match_refcount == MATCH_HIGHEST && hit->refcount < exclude->refcount))
 				continue;
 		}
 
 		uint8_t better_refcount = 0;
-		if((match_refcount == MATCH_LOWEST  && obj->refcount < best_refcount)
-		|| (match_refcount == MATCH_HIGHEST && obj->refcount > best_refcount))
+		if((match_refcount == MATCH_LOWEST  && hit->refcount < best_refcount)
+		|| (match_refcount == MATCH_HIGHEST && hit->refcount > best_refcount))
 			better_refcount = 1;
 
 		// for same-address objects, require better refcount
@@ -40,7 +61,7 @@ object_t* next_object(uint64_t addr, uint64_t search_len, object_t* exclude_obj,
 				continue;
 			next_obj = obj;
 			min_addr = addr;
-			best_refcount = obj->refcount;
+			best_refcount = hit->refcount;
 		}
 
 		// even if worse refcount, prioritize lowest address
@@ -48,18 +69,26 @@ object_t* next_object(uint64_t addr, uint64_t search_len, object_t* exclude_obj,
 			next_obj = obj;
 			min_addr = obj->addr;
 			if(better_refcount)
-				best_refcount = obj->refcount;
+				best_refcount = hit->refcount;
 		}
 	}
 
 	return next_obj;
 }
 
-object_t* get_portion(uint64_t addr, uint64_t* len, uint64_t max_len, uint8_t match_refcount) {
-	uint32_t count = get_region_object_count(addr, max_len);
+region_hit_t* find_hit(region_query_t* q, object_t* obj) {
+	for(uint32_t i = 0; i < q->count; i++)
+		if(q->hits[i].obj == obj)
+			return &q->hits[i];
+	return 0;
+}
+
+// q must hold the objects overlapping at least [addr, addr + max_len - 1]
+object_t* get_portion(region_query_t* q, uint64_t addr, uint64_t* len, uint64_t max_len, uint8_t match_refcount) {
+	object_t* obj = 0;
+	uint32_t count = count_hits(q, addr, max_len, &obj);
 
 	if(count == 1) {	// optimal case: single object
-		object_t* obj = get_region_object_list(0, addr, max_len);
 		if(obj->addr <= addr) {
 			uint64_t offset = addr - obj->addr;
 			uint64_t remaining = obj->len - offset;
@@ -77,7 +106,7 @@ object_t* get_portion(uint64_t addr, uint64_t* len, uint64_t max_len, uint8_t ma
 	}
 
 	// in maximum span, choose first object with highest or lowest refcount
-	object_t* chosen_obj = next_object(addr, max_len, 0, match_refcount);
+	object_t* chosen_obj = next_object(q, addr, max_len, 0, match_refcount);
 	if(!chosen_obj)
 		ERROR("get_portion failed to get object at %llx\n", addr);
 
@@ -90,7 +119,7 @@ object_t* get_portion(uint64_t addr, uint64_t* len, uint64_t max_len, uint8_t ma
 	uint64_t offset = addr - chosen_obj->addr;
 	uint64_t remaining = chosen_obj->len - offset;
 	remaining = remaining > max_len ? max_len : remaining;
-	count = get_region_object_count(addr, remaining);
+	count = count_hits(q, addr, remaining, 0);
 
 	// no other object before the end of this object or single byte portion
 	if(count == 1 || remaining == 1) {
@@ -99,7 +128,7 @@ object_t* get_portion(uint64_t addr, uint64_t* len, uint64_t max_len, uint8_t ma
 	}
 
 	// cut portion if there's another object before the end of this object
-	object_t* obj = next_object(addr + 1, remaining - 1, chosen_obj, match_refcount);
+	obj = next_object(q, addr + 1, remaining - 1, find_hit(q, chosen_obj), match_refcount);
 	if(obj)
 		remaining = obj->addr - addr;
 
@@ -107,17 +136,27 @@ object_t* get_portion(uint64_t addr, uint64_t* len, uint64_t max_len, uint8_t ma
 	return chosen_obj;
 }
 
+// drop state derived from VRAM contents in a range that is being written
+void vram_written(uint64_t addr, uint64_t len) {
+	invalidate_headers(addr, len);
+	invalidate_cmd_cache(addr, len);
+	objects_changed();
+}
+
 uint8_t* __gpu_read(uint8_t* dst, uint64_t src, uint64_t n, uint8_t match_refcount) {
 	if(!n || src + n >= VRAM_CAPACITY) {
 		WARN("gpu_read [%llx, %llx] out of VRAM bounds\n", src, src + n - 1);
 		return 0;
 	}
 
+	region_query_t q;
+	query_region(&q, src, n);
+
 	uint64_t addr = src, total_bytes_read = 0;
 	while(total_bytes_read < n) {
 		uint64_t max_len = n - total_bytes_read;
 		uint64_t read_len = 0;
-		object_t* obj = get_portion(addr, &read_len, max_len, match_refcount);
+		object_t* obj = get_portion(&q, addr, &read_len, max_len, match_refcount);
 
 		if(obj)
 			object_read(obj, dst + total_bytes_read, addr, read_len);
@@ -128,6 +167,7 @@ uint8_t* __gpu_read(uint8_t* dst, uint64_t src, uint64_t n, uint8_t match_refcou
 		addr += read_len;
 	}
 
+	free_region_query(&q);
 	return dst;
 }
 
@@ -145,21 +185,41 @@ void __gpu_write(uint64_t dst, uint8_t* src, uint64_t n, uint8_t match_refcount)
 		return;
 	}
 
+	region_query_t q;
+	query_region(&q, dst, n);
+
+	// pending writes of aliased objects are read from VRAM, upload them
+	// before VRAM changes underneath them. not needed if every object shares
+	// one store, as the write below then reaches all of them.
+	uint8_t shared = 1;
+	for(uint32_t i = 1; i < q.count && shared; i++)
+		shared = same_storage(q.hits[i].obj, q.hits[0].obj);
+
+	for(uint32_t i = 0; i < q.count && !shared; i++)
+		if(rangeset_overlaps(get_dirty(q.hits[i].obj), dst, dst + n - 1))
+			flush_dirty(q.hits[i].obj);
+
+	land_readbacks(dst, n);
 	memmove(vram + dst, src, n);
+	vram_written(dst, n);
 
 	uint64_t addr = dst, total_bytes_written = 0;
 	while(total_bytes_written < n) {
 		uint64_t max_len = n - total_bytes_written;
 		uint64_t write_len = 0;
-		object_t* obj = get_portion(addr, &write_len, max_len, match_refcount);
+		object_t* obj = get_portion(&q, addr, &write_len, max_len, match_refcount);
 
-		// to keep gpu_read coherent, we update GPU-side data immediately
-		if(obj)
+		// GPU-side data is uploaded lazily, gpu_read reads dirty ranges from VRAM
+		if(obj) {
+			mark_modified(obj, addr, write_len);
 			object_write(obj, addr, src + total_bytes_written, write_len);
+		}
 
 		total_bytes_written += write_len;
 		addr += write_len;
 	}
+
+	free_region_query(&q);
 }
 
 void gpu_write(uint64_t dst, uint8_t* src, uint64_t n) {
@@ -0,0 +1,192 @@
+#include "../../defs.h"
+
+// aliased objects with ranges modified since the last sync_overlaps()
+objvec_t modified_objs;
+rangeset_t conflicts;
+
+// objects only count as overlapping if they don't share storage; views of
+// the same buffer store are coherent by construction
+void mark_all_overlaps(object_t* obj) {
+	region_query_t q;
+	uint32_t count = query_region(&q, obj->addr, obj->len);
+
+	for(uint32_t i = 0; i < count; i++)
+		if(!same_storage(q.hits[i].obj, obj))
+			q.hits[i].obj->in_overlaps = obj->in_overlaps = 1;
+
+	free_region_query(&q);
+}
+
+uint8_t has_aliases(object_t* obj) {
+	region_query_t q;
+	uint32_t count = query_region(&q, obj->addr, obj->len);
+
+	uint8_t found = 0;
+	for(uint32_t i = 0; i < count && !found; i++)
+		found = !same_storage(q.hits[i].obj, obj);
+
+	free_region_query(&q);
+	return found;
+}
+
+// recompute the overlap state of every object in the region, e.g. after a free
+void update_overlaps(uint64_t addr, uint64_t len) {
+	region_query_t q;
+	uint32_t count = query_region(&q, addr, len);
+
+	for(uint32_t i = 0; i < count; i++) {
+		object_t* obj = q.hits[i].obj;
+		obj->in_overlaps = has_aliases(obj);
+		if(!obj->in_overlaps)
+			forget_modified(obj);
+	}
+
+	free_region_query(&q);
+}
+
+// record that an aliased object's contents diverged from its aliases
+void mark_modified(object_t* obj, uint64_t addr, uint64_t len) {
+	if(!obj->in_overlaps)
+		return;
+
+	if(!obj->modified.count)
+		objvec_push(&modified_objs, obj);
+	rangeset_add(&obj->modified, addr, addr + len - 1);
+}
+
+void forget_modified(object_t* obj) {
+	if(obj->modified.count)
+		objvec_remove(&modified_objs, obj);
+	rangeset_free(&obj->modified);
+}
+
+// copy [start, end] of src to every other object covering it
+void propagate(object_t* src, uint64_t start, uint64_t end) {
+	uint64_t len = end - start + 1;
+	uint8_t in_vram = 0;
+
+	region_query_t q;
+	uint32_t count = query_region(&q, start, len);
+
+	for(uint32_t i = 0; i < count; i++) {
+		object_t* dst = q.hits[i].obj;
+		if(same_storage(dst, src))
+			continue;	// overlapping buffer objects always share a store
+
+		uint64_t s = start > dst->addr ? start : dst->addr;
+		uint64_t e = dst->addr + dst->len - 1;
+		e = end < e ? end : e;
+
+		// data goes through VRAM, which object_write() expects
+		if(!in_vram) {
+			uint8_t* data = malloc(len);
+			object_read(src, data, start, len);
+			for(uint32_t j = 0; j < count; j++)
+				if(!same_storage(q.hits[j].obj, src))
+					flush_dirty(q.hits[j].obj);
+			memmove(vram + start, data, len);
+			vram_written(start, len);
+			free(data);
+			in_vram = 1;
+		}
+
+		object_write(dst, s, vram + s, e - s + 1);
+		if(dst->type == TYPE_KERNEL)
+			dst->need_update = 1;		// program must be rebuilt
+	}
+
+	free_region_query(&q);
+}
+
+// propagate the parts of [start, end] that don't intersect a conflict
+void propagate_outside_conflicts(object_t* src, uint64_t start, uint64_t end) {
+	for(uint32_t i = 0; i < conflicts.count; i++) {
+		range_t* c = &conflicts.ranges[i];
+		if(c->end < start)
+			continue;
+		if(c->start > end)
+			break;
+
+		if(c->start > start)
+			propagate(src, start, c->start - 1);
+		if(c->end >= end)
+			return;
+		start = c->end + 1;
+	}
+	propagate(src, start, end);
+}
+
+// where aliases disagree, write the newest data to VRAM and destroy every
+// object covering the conflict so it is recreated from VRAM
+void destroy_conflicts() {
+	objvec_t doomed;
+	memset(&doomed, 0, sizeof(objvec_t));
+
+	for(uint32_t i = 0; i < conflicts.count; i++) {
+		range_t* c = &conflicts.ranges[i];
+		region_query_t q;
+		uint32_t count = query_region(&q, c->start, c->end - c->start + 1);
+		for(uint32_t j = 0; j < count; j++) {
+			object_t* obj = q.hits[j].obj;
+			if(obj->in_destroy)
+				continue;
+			obj->in_destroy = 1;
+			objvec_push(&doomed, obj);
+		}
+		free_region_query(&q);
+	}
+
+	object_t** objs = OBJVEC_DATA(&doomed);
+	for(uint32_t i = 0; i < doomed.count; i++) {
+		uint8_t* data = malloc(objs[i]->len);
+		gpu_read_newest(data, objs[i]->addr, objs[i]->len);
+		memmove(vram + objs[i]->addr, data, objs[i]->len);
+		vram_written(objs[i]->addr, objs[i]->len);
+		free(data);
+	}
+
+	for(uint32_t i = 0; i < doomed.count; i++)
+		free_object(objs[i]);
+	objvec_free(&doomed);
+}
+
+// bring aliased objects back in sync, copying only the ranges that diverged
+void sync_overlaps() {
+	if(!modified_objs.count)
+		return;
+
+	// a range modified through more than one alias is a conflict
+	rangeset_clear(&conflicts);
+	for(uint32_t i = 0; i < modified_objs.count; i++) {
+		object_t* obj = OBJVEC_DATA(&modified_objs)[i];
+		for(uint32_t j = 0; j < obj->modified.count; j++) {
+			range_t* r = &obj->modified.ranges[j];
+			region_query_t q;
+			uint32_t count = query_region(&q, r->start, r->end - r->start + 1);
+			for(uint32_t k = 0; k < count; k++) {
+				object_t* alias = q.hits[k].obj;
+				uint64_t s = r->start > alias->addr ? r->start : alias->addr;
+				uint64_t e = alias->addr + alias->len - 1;
+				e = r->end < e ? r->end : e;
+				if(!same_storage(alias, obj)
+				&& rangeset_overlaps(&alias->modified, s, e))
+					rangeset_add(&conflicts, s, e);
+			}
+			free_region_query(&q);
+		}
+	}
+
+	for(uint32_t i = 0; i < modified_objs.count; i++) {
+		object_t* obj = OBJVEC_DATA(&modified_objs)[i];
+		for(uint32_t j = 0; j < obj->modified.count; j++)
+			propagate_outside_conflicts(obj, obj->modified.ranges[j].start,
+				obj->modified.ranges[j].end);
+	}
+
+	if(conflicts.count)
+		destroy_conflicts();
+
+	for(uint32_t i = 0; i < modified_objs.count; i++)
+		rangeset_clear(&OBJVEC_DATA(&modified_objs)[i]->modified);
+	objvec_clear(&modified_objs);
+}
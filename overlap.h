@@ -0,0 +1,12 @@
+#ifndef OVERLAP_H
+#define OVERLAP_H
+
+#include "../../defs.h"
+
+void mark_all_overlaps(object_t* obj);
+void update_overlaps(uint64_t addr, uint64_t len);
+void mark_modified(object_t* obj, uint64_t addr, uint64_t len);
+void forget_modified(object_t* obj);
+void sync_overlaps();
+
+#endif
@@ -0,0 +1,85 @@
+#include "../../defs.h"
+
+object_t* free_objs;
+alloc_stats_t alloc_stats;
+
+void objvec_push(objvec_t* v, object_t* obj) {
+	uint32_t capacity = v->heap ? v->capacity : OBJVEC_INLINE;
+
+	if(v->count == capacity) {
+		capacity *= 2;
+		if(!v->heap) {
+			v->heap = malloc(sizeof(object_t*) * capacity);
+			memcpy(v->heap, v->inline_objs, sizeof(v->inline_objs));
+		} else
+			v->heap = realloc(v->heap, sizeof(object_t*) * capacity);
+		v->capacity = capacity;
+		alloc_stats.vec_grows++;
+	}
+
+	OBJVEC_DATA(v)[v->count++] = obj;
+}
+
+// unordered remove, returns 1 if obj was found
+uint8_t objvec_remove(objvec_t* v, object_t* obj) {
+	object_t** objs = OBJVEC_DATA(v);
+
+	for(uint32_t i = 0; i < v->count; i++)
+		if(objs[i] == obj) {
+			objs[i] = objs[--v->count];
+			if(!v->count)
+				objvec_free(v);
+			return 1;
+		}
+	return 0;
+}
+
+// empty the vector but keep its storage
+void objvec_clear(objvec_t* v) {
+	v->count = 0;
+}
+
+void objvec_free(objvec_t* v) {
+	if(v->heap) {
+		free(v->heap);
+		alloc_stats.vec_frees++;
+	}
+	v->heap = (void*)0;
+	v->capacity = 0;
+	v->count = 0;
+}
+
+// objects are carved from slabs and recycled through a free list; slabs are
+// never returned to the heap
+object_t* alloc_object() {
+	if(!free_objs) {
+		object_t* slab = malloc(sizeof(object_t) * OBJ_SLAB_COUNT);
+		if(!slab)
+			ERROR("failed to allocate object slab\n");
+		for(uint32_t i = 0; i < OBJ_SLAB_COUNT; i++) {
+			slab[i].next_free = free_objs;
+			free_objs = &slab[i];
+		}
+		alloc_stats.slab_allocs++;
+	}
+
+	object_t* obj = free_objs;
+	free_objs = obj->next_free;
+	memset(obj, 0, sizeof(object_t));
+	alloc_stats.obj_allocs++;
+	return obj;
+}
+
+void release_object(object_t* obj) {
+	obj->next_free = free_objs;
+	free_objs = obj;
+	alloc_stats.obj_frees++;
+}
+
+alloc_stats_t* get_alloc_stats() {
+	return &alloc_stats;
+}
+
+void reset_alloc_stats() {
+	memset(&alloc_stats, 0, sizeof(alloc_stats_t));
+}
@@ -0,0 +1,38 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "../../defs.h"
+
+#define OBJ_SLAB_COUNT	256		/* objects per pool slab */
+#define OBJVEC_INLINE	2
+
+// object pointer vector with geometric growth; the first OBJVEC_INLINE
+// entries are stored inline so most buckets never touch the heap
+typedef struct objvec_t {
+	uint32_t count;
+	uint32_t capacity;		// 0 while using inline storage
+	struct object_t** heap;
+	struct object_t* inline_objs[OBJVEC_INLINE];
+} objvec_t;
+
+#define OBJVEC_DATA(v) ((v)->heap ? (v)->heap : (v)->inline_objs)
+
+// allocation traffic since the last reset_alloc_stats()
+typedef struct alloc_stats_t {
+	uint64_t obj_allocs;	// objects handed out by the pool
+	uint64_t obj_frees;
+	uint64_t slab_allocs;	// heap allocations to grow the pool
+	uint64_t vec_grows;		// heap (re)allocations of object vectors
+	uint64_t vec_frees;
+} alloc_stats_t;
+
+void objvec_push(objvec_t* v, struct object_t* obj);
+uint8_t objvec_remove(objvec_t* v, struct object_t* obj);
+void objvec_clear(objvec_t* v);
+void objvec_free(objvec_t* v);
+struct object_t* alloc_object();
+void release_object(struct object_t* obj);
+alloc_stats_t* get_alloc_stats();
+void reset_alloc_stats();
+
+#endif
@@ -0,0 +1,59 @@
+#include "../../defs.h"
+
+// index of the first range that ends at or after addr
+uint32_t rangeset_lower_bound(rangeset_t* set, uint64_t addr) {
+	uint32_t lo = 0, hi = set->count;
+	while(lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if(set->ranges[mid].end < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// add [start, end], merging with any overlapping or adjacent ranges
+void rangeset_add(rangeset_t* set, uint64_t start, uint64_t end) {
+	uint32_t i = rangeset_lower_bound(set, start ? start - 1 : 0);
+	uint32_t j = i;
+	while(j < set->count && set->ranges[j].start <= end + 1) {
+		if(set->ranges[j].start < start)
+			start = set->ranges[j].start;
+		if(set->ranges[j].end > end)
+			end = set->ranges[j].end;
+		j++;
+	}
+
+	if(i == j) {	// nothing merged, insert a new range at i
+		if(set->count == set->capacity) {
+			set->capacity = set->capacity ? set->capacity * 2 : 4;
+			set->ranges = realloc(set->ranges, sizeof(range_t) * set->capacity);
+		}
+		memmove(set->ranges + i + 1, set->ranges + i,
+			sizeof(range_t) * (set->count - i));
+		set->count++;
+	} else {		// ranges [i, j) collapse into i
+		memmove(set->ranges + i + 1, set->ranges + j,
+			sizeof(range_t) * (set->count - j));
+		set->count -= j - i - 1;
+	}
+
+	set->ranges[i].start = start;
+	set->ranges[i].end = end;
+}
+
+uint8_t rangeset_overlaps(rangeset_t* set, uint64_t start, uint64_t end) {
+	uint32_t i = rangeset_lower_bound(set, start);
+	return i < set->count && set->ranges[i].start <= end;
+}
+
+void rangeset_clear(rangeset_t* set) {
+	set->count = 0;
+}
+
+void rangeset_free(rangeset_t* set) {
+	free(set->ranges);
+	set->ranges = (void*)0;
+	set->count = set->capacity = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include "../../defs.h"
+
+typedef struct range_t {
+	uint64_t start, end;	// inclusive
+} range_t;
+
+// sorted set of disjoint, non-adjacent ranges
+typedef struct rangeset_t {
+	uint32_t count;
+	uint32_t capacity;
+	range_t* ranges;
+} rangeset_t;
+
+void rangeset_add(rangeset_t* set, uint64_t start, uint64_t end);
+uint8_t rangeset_overlaps(rangeset_t* set, uint64_t start, uint64_t end);
+void rangeset_clear(rangeset_t* set);
+void rangeset_free(rangeset_t* set);
+
+#endif
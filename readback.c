@@ -0,0 +1,156 @@
+#include "../../defs.h"
+
+// DMA reads don't stall on GL downloads. object data is packed or copied into
+// a buffer, and the GPU thread lands it in VRAM once its fence signals. the
+// transfer's copies start after its last readback lands.
+readback_t *readbacks_head, *readbacks_tail;
+readback_buffer_t readback_pool[READBACK_POOL_SIZE];
+uint32_t readback_pool_count;
+readback_stats_t readback_stats;
+
+readback_buffer_t get_readback_buffer(uint64_t len) {
+	for(uint32_t i = 0; i < readback_pool_count; i++)
+		if(readback_pool[i].capacity >= len) {
+			readback_buffer_t b = readback_pool[i];
+			readback_pool[i] = readback_pool[--readback_pool_count];
+			return b;
+		}
+
+	readback_buffer_t b = { 0, len };
+	glGenBuffers(1, &b.gl_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, b.gl_buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, len, NULL, GL_STREAM_READ);
+	return b;
+}
+
+// keep the buffer for reuse, replacing the smallest if the pool is full
+void release_readback_buffer(readback_buffer_t b) {
+	if(readback_pool_count < READBACK_POOL_SIZE) {
+		readback_pool[readback_pool_count++] = b;
+		return;
+	}
+
+	uint32_t smallest = 0;
+	for(uint32_t i = 1; i < READBACK_POOL_SIZE; i++)
+		if(readback_pool[i].capacity < readback_pool[smallest].capacity)
+			smallest = i;
+	if(readback_pool[smallest].capacity < b.capacity) {
+		readback_buffer_t evicted = readback_pool[smallest];
+		readback_pool[smallest] = b;
+		b = evicted;
+	}
+	glDeleteBuffers(1, &b.gl_buffer);
+}
+
+// bring VRAM up to date with obj before t copies from it
+void read_back_object(object_t* obj, dma_transfer_t* t) {
+	if(!HAS_GL_STORAGE(obj->type))
+		return;		// VRAM already holds the data
+
+	// aliased objects resolve their newest data through VRAM
+	if(obj->in_overlaps) {
+		flush_object(obj);
+		readback_stats.sync++;
+		return;
+	}
+
+	// the header always lives in VRAM
+	uint64_t header_len = get_header_length(obj->type);
+	readback_t* rb = malloc(sizeof(readback_t));
+	rb->addr = obj->addr + header_len;
+	rb->len = obj->type == TYPE_TBO ? get_tex_data_size(&obj->header) : obj->len - header_len;
+	if(!rb->len) {
+		free(rb);
+		return;
+	}
+
+	// pending writes are in VRAM only, upload them so the copy includes them
+	flush_dirty(obj);
+
+	rb->buffer = get_readback_buffer(rb->len);
+	if(obj->store)
+		copy_from_store(obj->store, rb->buffer.gl_buffer, rb->addr, rb->len);
+	else
+		download_texture(obj, rb->buffer.gl_buffer);
+
+	rb->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	rb->transfer = t;
+	rb->issued_ns = now_ns();
+	rb->next = 0;
+	t->pending_readbacks++;
+
+	if(readbacks_tail)
+		readbacks_tail->next = rb;
+	else
+		readbacks_head = rb;
+	readbacks_tail = rb;
+	readback_stats.async++;
+}
+
+void land_readback(readback_t* rb) {
+	glDeleteSync(rb->sync);
+	readbacks_head = rb->next;
+	if(!readbacks_head)
+		readbacks_tail = 0;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, rb->buffer.gl_buffer);
+	uint8_t* data = glMapBufferRange(GL_COPY_READ_BUFFER, 0, rb->len, GL_MAP_READ_BIT);
+	if(data) {
+		memmove(vram + rb->addr, data, rb->len);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		vram_written(rb->addr, rb->len);
+	} else
+		WARN("readback of [%llx, %llx] failed to map\n", rb->addr, rb->addr + rb->len - 1);
+	release_readback_buffer(rb->buffer);
+
+	readback_stats.landed++;
+	readback_stats.bytes += rb->len;
+	readback_stats.latency_ns += now_ns() - rb->issued_ns;
+
+	if(!--rb->transfer->pending_readbacks)
+		submit_chunks(rb->transfer);
+	free(rb);
+}
+
+// land the readbacks that have completed, in issue order. called on the GPU thread.
+void retire_readbacks() {
+	while(readbacks_head) {
+		if(glClientWaitSync(readbacks_head->sync, 0, 0) == GL_TIMEOUT_EXPIRED)
+			return;
+		land_readback(readbacks_head);
+	}
+}
+
+// called before [addr, addr + len - 1] of VRAM is written, so a readback issued
+// earlier can't land its older data over the write. waits for every readback
+// up to the last one overlapping the range, as they land in issue order.
+void land_readbacks(uint64_t addr, uint64_t len) {
+	readback_t* last = 0;
+	for(readback_t* rb = readbacks_head; rb; rb = rb->next)
+		if(check_overlap(addr, addr + len - 1, rb->addr, rb->addr + rb->len - 1))
+			last = rb;
+	if(!last)
+		return;
+
+	uint8_t done = 0;
+	while(!done) {
+		readback_t* rb = readbacks_head;
+		done = rb == last;
+		while(glClientWaitSync(rb->sync, 0, READBACK_POLL_NS) == GL_TIMEOUT_EXPIRED);
+		land_readback(rb);
+		readback_stats.forced++;
+	}
+}
+
+uint8_t readbacks_pending() {
+	return readbacks_head != 0;
+}
+
+readback_stats_t* get_readback_stats() {
+	return &readback_stats;
+}
+
+void reset_readback_stats() {
+	memset(&readback_stats, 0, sizeof(readback_stats_t));
+}
@@ -0,0 +1,43 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+#include "../../defs.h"
+
+#define READBACK_POOL_SIZE	8			/* idle readback buffers kept for reuse */
+#define READBACK_POLL_NS	250000		/* GPU thread wait while only readbacks are pending */
+
+// GL buffer the data of one object is packed or copied into
+typedef struct readback_buffer_t {
+	GLuint gl_buffer;
+	uint64_t capacity;
+} readback_buffer_t;
+
+// copy of an object's GL data on its way to VRAM, landing once sync signals
+typedef struct readback_t {
+	readback_buffer_t buffer;
+	GLsync sync;
+	uint64_t addr;			// VRAM range the data is written to
+	uint64_t len;
+	dma_transfer_t* transfer;		// DMA waiting on the readback
+	uint64_t issued_ns;
+	struct readback_t* next;
+} readback_t;
+
+// readbacks since the last reset_readback_stats()
+typedef struct readback_stats_t {
+	uint64_t async;			// objects read back through a buffer and fence
+	uint64_t landed;		// async readbacks written to VRAM
+	uint64_t sync;			// objects flushed with a stall (aliased objects)
+	uint64_t forced;		// async readbacks waited for, as VRAM under them was written
+	uint64_t bytes;			// bytes landed by async readbacks
+	uint64_t latency_ns;	// issue to landing, summed over landed readbacks
+} readback_stats_t;
+
+void read_back_object(object_t* obj, dma_transfer_t* t);
+void retire_readbacks();
+void land_readbacks(uint64_t addr, uint64_t len);
+uint8_t readbacks_pending();
+readback_stats_t* get_readback_stats();
+void reset_readback_stats();
+
+#endif
@@ -0,0 +1,264 @@
+#include "../../defs.h"
+
+itree_node_t* store_tree;
+
+buffer_store_t** dirty_stores;
+uint32_t n_dirty_stores, dirty_stores_capacity;
+
+int8_t has_buffer_storage = -1;
+uint64_t gpu_serial = 1;	// bumped each time the CPU waits for the GPU
+
+uint8_t use_persistent_buffers() {
+	if(has_buffer_storage == -1) {
+		GLint major = 0, minor = 0, n_exts = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		has_buffer_storage = major > 4 || (major == 4 && minor >= 4);
+
+		glGetIntegerv(GL_NUM_EXTENSIONS, &n_exts);
+		for(GLint i = 0; i < n_exts && !has_buffer_storage; i++)
+			if(!strcmp((char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_buffer_storage"))
+				has_buffer_storage = 1;
+	}
+	return ENABLE_PERSISTENT_BUFFERS && has_buffer_storage;
+}
+
+// record that GPU commands issued from now on may access obj
+void mark_gpu_use(object_t* obj) {
+	if(obj->store)
+		obj->store->gpu_serial = gpu_serial;
+}
+
+// wait for GPU commands that may access a mapped store to complete
+void sync_store(buffer_store_t* store) {
+	if(store->gpu_serial != gpu_serial)
+		return;		// not used since the last wait
+
+	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, NS_PER_SEC)
+		== GL_TIMEOUT_EXPIRED);
+	glDeleteSync(fence);
+	gpu_serial++;
+}
+
+// contents are undefined until written
+buffer_store_t* create_store(uint64_t addr, uint64_t len) {
+	buffer_store_t* store = calloc(1, sizeof(buffer_store_t));
+	store->addr = addr;
+	store->len = len;
+
+	glGenBuffers(1, &store->gl_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, store->gl_buffer);
+
+	if(use_persistent_buffers()) {
+		GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT
+			| GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, len, 0, flags);
+		store->gl_map = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, len, flags);
+		if(!store->gl_map)
+			ERROR("failed to map buffer store %llx\n", addr);
+	} else
+		glBufferData(GL_COPY_WRITE_BUFFER, len, 0, GL_STATIC_DRAW);
+
+	store->tree_node.start = addr;
+	store->tree_node.end = addr + len - 1;
+	store->tree_node.data = store;
+	itree_insert(&store_tree, &store->tree_node);
+	return store;
+}
+
+void remove_dirty_store(buffer_store_t* store) {
+	for(uint32_t i = 0; i < n_dirty_stores; i++)
+		if(dirty_stores[i] == store) {
+			dirty_stores[i] = dirty_stores[--n_dirty_stores];
+			break;
+		}
+	rangeset_clear(&store->dirty);
+}
+
+void free_store(buffer_store_t* store) {
+	if(store->dirty.count)		// pending data is in VRAM already
+		remove_dirty_store(store);
+	rangeset_free(&store->dirty);
+	objvec_free(&store->views);
+	itree_remove(&store_tree, &store->tree_node);
+	forget_vao_buffer(store->gl_buffer);
+	glDeleteBuffers(1, &store->gl_buffer);		// also unmaps gl_map
+	free(store);
+}
+
+void add_view(buffer_store_t* store, object_t* obj) {
+	obj->store = store;
+	obj->gl_buffer = store->gl_buffer;
+	obj->gl_offset = obj->addr - store->addr;
+	objvec_push(&store->views, obj);
+}
+
+void collect_store(itree_node_t* node, void* arg) {
+	buffer_store_t*** list = arg;
+	**list = node->data;
+	(*list)++;
+}
+
+// store contents are only kept coherent where a view exists. load the parts
+// of obj's range that no other view covers from VRAM and other objects.
+void load_uncovered(buffer_store_t* store, object_t* obj) {
+	rangeset_t covered;
+	memset(&covered, 0, sizeof(rangeset_t));
+	for(uint32_t i = 0; i < store->views.count; i++) {
+		object_t* view = OBJVEC_DATA(&store->views)[i];
+		rangeset_add(&covered, view->addr, view->addr + view->len - 1);
+	}
+
+	uint64_t addr = obj->addr, end = obj->addr + obj->len - 1;
+	uint8_t* data = malloc(obj->len);
+	for(uint32_t i = 0; i <= covered.count && addr <= end; i++) {
+		uint64_t gap_end = end;
+		if(i < covered.count) {
+			range_t* r = &covered.ranges[i];
+			if(r->end < addr)
+				continue;
+			if(r->start <= addr) {
+				addr = r->end + 1;
+				continue;
+			}
+			gap_end = r->start - 1 < end ? r->start - 1 : end;
+		}
+
+		gpu_read(data, addr, gap_end - addr + 1);
+		write_store(store, addr, data, gap_end - addr + 1);
+		addr = gap_end + 1;
+	}
+
+	free(data);
+	rangeset_free(&covered);
+}
+
+// back a new buffer object with the store covering its range. a store is
+// created if there is none, and partially overlapping stores are merged into
+// one covering all of them. must be called before obj is added to bo_tree.
+void attach_store(object_t* obj) {
+	uint64_t start = obj->addr, end = obj->addr + obj->len - 1;
+
+	uint32_t count = itree_count(store_tree, start, end);
+	buffer_store_t** stores = malloc(sizeof(buffer_store_t*) * (count ? count : 1));
+	buffer_store_t** list = stores;
+	itree_query(store_tree, start, end, collect_store, &list);
+
+	// optimal case: an existing store already holds this range
+	if(count == 1 && stores[0]->addr <= start
+	&& stores[0]->addr + stores[0]->len - 1 >= end) {
+		buffer_store_t* store = stores[0];
+		free(stores);
+		flush_store(store);
+		load_uncovered(store, obj);
+		add_view(store, obj);
+		return;
+	}
+
+	// stores come sorted by address and don't overlap
+	if(count) {
+		if(stores[0]->addr < start)
+			start = stores[0]->addr;
+		buffer_store_t* last = stores[count - 1];
+		if(last->addr + last->len - 1 > end)
+			end = last->addr + last->len - 1;
+	}
+
+	buffer_store_t* store = create_store(start, end - start + 1);
+
+	// move the old stores' contents and views into the new store
+	for(uint32_t i = 0; i < count; i++) {
+		buffer_store_t* old = stores[i];
+		flush_store(old);
+
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_COPY_READ_BUFFER, old->gl_buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, store->gl_buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+			old->addr - start, old->len);
+		store->gpu_serial = gpu_serial;		// written by the GPU copy
+
+		for(uint32_t j = 0; j < old->views.count; j++)
+			add_view(store, OBJVEC_DATA(&old->views)[j]);
+		free_store(old);
+	}
+
+	load_uncovered(store, obj);
+	add_view(store, obj);
+	free(stores);
+}
+
+void detach_store(object_t* obj) {
+	buffer_store_t* store = obj->store;
+	objvec_remove(&store->views, obj);
+	obj->store = 0;
+	if(!store->views.count)
+		free_store(store);
+}
+
+// read from the store's GL buffer, ignoring pending dirty ranges
+void read_store(buffer_store_t* store, uint8_t* dst, uint64_t src, uint64_t n) {
+	if(store->gl_map) {
+		sync_store(store);
+		memcpy(dst, store->gl_map + (src - store->addr), n);
+		return;
+	}
+
+	if(store->gpu_serial == gpu_serial)		// may hold shader writes
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_COPY_READ_BUFFER, store->gl_buffer);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, src - store->addr, n, dst);
+}
+
+// copy [src, src + n - 1] into gl_buffer at offset 0 on the GPU, without waiting
+void copy_from_store(buffer_store_t* store, GLuint gl_buffer, uint64_t src, uint64_t n) {
+	if(store->gpu_serial == gpu_serial)		// may hold shader writes
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_COPY_READ_BUFFER, store->gl_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, gl_buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src - store->addr, 0, n);
+}
+
+void write_store(buffer_store_t* store, uint64_t dst, uint8_t* src, uint64_t n) {
+	if(store->gl_map) {
+		sync_store(store);
+		memcpy(store->gl_map + (dst - store->addr), src, n);
+		return;
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, store->gl_buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, dst - store->addr, n, src);
+}
+
+// record a write for upload by flush_store(); the data must already be in VRAM
+void mark_store_dirty(buffer_store_t* store, uint64_t addr, uint64_t len) {
+	if(!store->dirty.count) {
+		if(n_dirty_stores == dirty_stores_capacity) {
+			dirty_stores_capacity = dirty_stores_capacity ? dirty_stores_capacity * 2 : 8;
+			dirty_stores = realloc(dirty_stores,
+				sizeof(buffer_store_t*) * dirty_stores_capacity);
+		}
+		dirty_stores[n_dirty_stores++] = store;
+	}
+	rangeset_add(&store->dirty, addr, addr + len - 1);
+}
+
+// upload pending writes to the store, one call per merged range
+void flush_store(buffer_store_t* store) {
+	if(!store->dirty.count)
+		return;
+
+	for(uint32_t i = 0; i < store->dirty.count; i++) {
+		range_t* r = &store->dirty.ranges[i];
+		write_store(store, r->start, vram + r->start, r->end - r->start + 1);
+	}
+
+	remove_dirty_store(store);
+}
+
+void flush_all_stores() {
+	while(n_dirty_stores)
+		flush_store(dirty_stores[0]);
+}
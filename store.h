@@ -0,0 +1,35 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "../../defs.h"
+
+// map buffer stores persistently when GL 4.4 buffer storage is available
+#define ENABLE_PERSISTENT_BUFFERS 1
+
+// GL buffer shared by every buffer-typed object (VBO, IBO, UBO, SBO) within
+// its range. objects are typed views at an offset into the store, so the same
+// memory referenced as different buffer types needs no copies to stay
+// coherent. stores never overlap each other.
+typedef struct buffer_store_t {
+	uint64_t addr;
+	uint64_t len;
+	GLuint gl_buffer;
+	uint8_t* gl_map;		// persistent mapping of gl_buffer, if any
+	uint64_t gpu_serial;	// see mark_gpu_use()
+	rangeset_t dirty;		// written ranges not yet uploaded to gl_buffer
+	objvec_t views;
+	itree_node_t tree_node;
+} buffer_store_t;
+
+uint8_t use_persistent_buffers();
+void attach_store(object_t* obj);
+void detach_store(object_t* obj);
+void read_store(buffer_store_t* store, uint8_t* dst, uint64_t src, uint64_t n);
+void copy_from_store(buffer_store_t* store, GLuint gl_buffer, uint64_t src, uint64_t n);
+void write_store(buffer_store_t* store, uint64_t dst, uint8_t* src, uint64_t n);
+void mark_store_dirty(buffer_store_t* store, uint64_t addr, uint64_t len);
+void flush_store(buffer_store_t* store);
+void flush_all_stores();
+void mark_gpu_use(object_t* obj);
+
+#endif
@@ -107,6 +107,18 @@ void download_level(object_t* obj, uint32_t level, uint8_t* dst) {
 	glGetTexImage(target, level, gl_fmt, gl_type, dst);
 }
 
+// pack every level into gl_buffer at its offset in the texture data, without
+// waiting for the GPU
+void download_texture(object_t* obj, GLuint gl_buffer) {
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, gl_buffer);
+	uint32_t level_count = get_tex_level_count(&obj->header);
+	for(uint32_t i = 0; i < level_count; i++) {
+		uint64_t offset = get_tex_level_offset(&obj->header, i);
+		download_level(obj, i, (uint8_t*)(uintptr_t)offset);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
 void upload_texture(object_t* obj, uint8_t* data) {
 	GLenum target = get_tex_gl_target(obj->header.n_dims);
 
@@ -117,10 +129,191 @@ void upload_texture(object_t* obj, uint8_t* data) {
 	}
 }
 
+// scratch for partial texels and fallbacks, grown as needed and never freed
+uint8_t* tex_scratch;
+uint64_t tex_scratch_capacity;
+GLuint tex_read_fbo;
+
+uint8_t* get_tex_scratch(uint64_t len) {
+	if(len > tex_scratch_capacity) {
+		tex_scratch = realloc(tex_scratch, len);
+		tex_scratch_capacity = len;
+	}
+	return tex_scratch;
+}
+
+// cover texels [first, first + count - 1] of a level, in its linear layout,
+// with boxes: a partial row, whole rows, whole slices, whole rows and a partial
+// row, as present. returns the number of spans.
+uint32_t get_tex_spans(uint32_t dims[3], uint64_t first, uint64_t count,
+	tex_span_t spans[MAX_TEX_SPANS]) {
+	uint64_t w = dims[0], row_texels = w, slice_texels = w * dims[1];
+	uint32_t n_spans = 0;
+
+	while(count) {
+		tex_span_t* s = &spans[n_spans++];
+		s->x = first % row_texels;
+		s->y = (first % slice_texels) / row_texels;
+		s->z = first / slice_texels;
+		s->w = w;
+		s->h = 1;
+		s->d = 1;
+
+		if(s->x || count < row_texels)
+			s->w = w - s->x < count ? w - s->x : count;
+		else if(s->y || count < slice_texels)
+			s->h = dims[1] - s->y < count / row_texels
+				? dims[1] - s->y : count / row_texels;
+		else {
+			s->h = dims[1];
+			s->d = count / slice_texels;
+		}
+
+		uint64_t texels = (uint64_t)s->w * s->h * s->d;
+		first += texels;
+		count -= texels;
+	}
+	return n_spans;
+}
+
+void upload_span(object_t* obj, uint32_t level, tex_span_t* s, uint8_t* src) {
+	header_t* hdr = &obj->header;
+	GLenum gl_fmt	= GET_FORMAT_GL_FORMAT(hdr->tex_format);
+	GLenum gl_type	= GET_FORMAT_GL_TYPE(hdr->tex_format);
+
+	GLenum target = get_tex_gl_target(hdr->n_dims);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(target, obj->gl_buffer);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	switch(target) {
+		case GL_TEXTURE_1D:
+			glTexSubImage1D(target, level, s->x, s->w, gl_fmt, gl_type, src);
+			break;
+		case GL_TEXTURE_2D:
+			glTexSubImage2D(target, level, s->x, s->y, s->w, s->h, gl_fmt, gl_type, src);
+			break;
+		case GL_TEXTURE_3D:
+			glTexSubImage3D(target, level, s->x, s->y, s->z, s->w, s->h, s->d,
+				gl_fmt, gl_type, src);
+			break;
+	}
+}
+
+// GL 4.3 has no sub-image download, so the level is read through a
+// framebuffer. returns 0 if it can't be attached.
+uint8_t download_span(object_t* obj, uint32_t level, tex_span_t* s, uint8_t* dst) {
+	header_t* hdr = &obj->header;
+	GLenum gl_fmt	= GET_FORMAT_GL_FORMAT(hdr->tex_format);
+	GLenum gl_type	= GET_FORMAT_GL_TYPE(hdr->tex_format);
+	GLenum attach	= get_blit_attachment(hdr->tex_format);
+	GLenum target	= get_tex_gl_target(hdr->n_dims);
+	uint64_t slice_bytes = (uint64_t)s->w * s->h * GET_FORMAT_BPP(hdr->tex_format);
+
+	GLint prev_fbo;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_fbo);
+	if(!tex_read_fbo)
+		glGenFramebuffers(1, &tex_read_fbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, tex_read_fbo);
+	glReadBuffer(attach == GL_COLOR_ATTACHMENT0 ? GL_COLOR_ATTACHMENT0 : GL_NONE);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	uint8_t ok = 1;
+	for(uint32_t z = s->z; z < s->z + s->d && ok; z++) {
+		if(target == GL_TEXTURE_1D)
+			glFramebufferTexture1D(GL_READ_FRAMEBUFFER, attach, target, obj->gl_buffer, level);
+		else if(target == GL_TEXTURE_2D)
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, attach, target, obj->gl_buffer, level);
+		else
+			glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, attach, obj->gl_buffer, level, z);
+
+		ok = glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		if(ok)
+			glReadPixels(s->x, s->y, s->w, s->h, gl_fmt, gl_type,
+				dst + (z - s->z) * slice_bytes);
+	}
+
+	// detach so deleting the texture doesn't leave it attached
+	glFramebufferTexture(GL_READ_FRAMEBUFFER, attach, 0, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_fbo);
+	return ok;
+}
+
+// move texels [first, first + count - 1] of a level between GL and data,
+// where they are tightly packed. reads return 0 if they must fall back to
+// downloading the whole level.
+uint8_t rw_texels(uint8_t is_read, object_t* obj, uint32_t level, uint8_t* data,
+	uint64_t first, uint64_t count) {
+	header_t* hdr = &obj->header;
+	uint32_t bpp = GET_FORMAT_BPP(hdr->tex_format);
+	uint32_t dims[3];
+	get_tex_level_dims(hdr, level, dims);
+	for(uint32_t i = hdr->n_dims; i < 3; i++)
+		dims[i] = 1;
+
+	tex_span_t spans[MAX_TEX_SPANS];
+	uint32_t n_spans = get_tex_spans(dims, first, count, spans);
+	for(uint32_t i = 0; i < n_spans; i++) {
+		tex_span_t* s = &spans[i];
+		uint64_t span_first = ((uint64_t)s->z * dims[1] + s->y) * dims[0] + s->x;
+		uint8_t* span_data = data + (span_first - first) * bpp;
+		if(!is_read)
+			upload_span(obj, level, s, span_data);
+		else if(!download_span(obj, level, s, span_data))
+			return 0;
+	}
+	return 1;
+}
+
+// access [offset, offset + n - 1] of one level. only the rows it covers are
+// transferred; partial texels at its ends are merged with their current value.
+void rw_level(uint8_t is_read, object_t* obj, uint32_t level, uint8_t* data,
+	uint64_t offset, uint64_t n) {
+	header_t* hdr = &obj->header;
+	uint32_t bpp = GET_FORMAT_BPP(hdr->tex_format);
+	uint64_t first = offset / bpp;
+	uint64_t count = (offset + n - 1) / bpp - first + 1;
+	uint64_t head = offset % bpp;
+	uint8_t aligned = !head && !((offset + n) % bpp);
+
+	if(aligned && !is_read) {
+		rw_texels(0, obj, level, data, first, count);
+		return;
+	}
+
+	uint8_t* texels = aligned ? data : get_tex_scratch(count * bpp);
+	uint8_t read_ok;
+	if(is_read)
+		read_ok = rw_texels(1, obj, level, texels, first, count);
+	else
+		read_ok = rw_texels(1, obj, level, texels, first, 1) &&
+			rw_texels(1, obj, level, texels + (count - 1) * bpp, first + count - 1, 1);
+
+	if(read_ok) {
+		if(is_read) {
+			if(!aligned)
+				memcpy(data, texels + head, n);
+		} else {
+			memcpy(texels + head, data, n);
+			rw_texels(0, obj, level, texels, first, count);
+		}
+		return;
+	}
+
+	// the level can't be read through a framebuffer, transfer all of it
+	uint32_t dims[3];
+	get_tex_level_dims(hdr, level, dims);
+	uint8_t* level_data = get_tex_scratch(calc_level_size(hdr->tex_format, hdr->n_dims, dims));
+	download_level(obj, level, level_data);
+	if(is_read)
+		memcpy(data, level_data + offset, n);
+	else {
+		memcpy(level_data + offset, data, n);
+		upload_level(obj, level, level_data);
+	}
+}
+
 void rw_texture(uint8_t is_read, object_t* obj, uint8_t* data, uint64_t addr, uint64_t n) {
 	header_t* hdr = &obj->header;
-	uint8_t fmt = hdr->tex_format;
-	uint32_t bpp = GET_FORMAT_BPP(fmt);
 	uint64_t offset = addr - obj->addr - get_header_length(TYPE_TBO);
 
 	uint32_t level_count = get_tex_level_count(hdr);
@@ -131,8 +324,6 @@ void rw_texture(uint8_t is_read, object_t* obj, uint8_t* data, uint64_t addr, ui
 		first_level = i;
 	}
 
-	uint8_t* tmp_data = malloc(calc_level_size(hdr->tex_format, hdr->n_dims, hdr->dims));
-
 	for(uint64_t curr_level = first_level; n; curr_level++) {
 		uint32_t level_dims[3];
 		get_tex_level_dims(hdr, curr_level, level_dims);
@@ -144,21 +335,12 @@ void rw_texture(uint8_t is_read, object_t* obj, uint8_t* data, uint64_t addr, ui
 		uint64_t bytes_to_access = level_end - offset + 1;
 		bytes_to_access = bytes_to_access < n ? bytes_to_access : n;
 
-		if(is_read) {
-			download_level(obj, curr_level, tmp_data);
-			memcpy(data, tmp_data + (offset - level_start), bytes_to_access);
-		} else {
-			download_level(obj, curr_level, tmp_data);
-			memcpy(tmp_data + (offset - level_start), data, bytes_to_access);
-			upload_level(obj, curr_level, tmp_data);
-		}
+		rw_level(is_read, obj, curr_level, data, offset - level_start, bytes_to_access);
 
 		n -= bytes_to_access;
 		data += bytes_to_access;
 		offset += bytes_to_access;
 	}
-
-	free(tmp_data);
 }
 
 void read_texture(object_t* obj, uint8_t* dst, uint64_t src, uint64_t n) {
@@ -33,6 +33,8 @@
 #define IS_COLOR_FORMAT(x) (!(IS_DEPTH_FORMAT(x) || IS_DEPTH_STENCIL_FORMAT(x)))
 #define IS_DEPTH_FORMAT(x) (x == FORMAT_DEPTH_16 || x == FORMAT_DEPTH_32F)
 #define IS_DEPTH_STENCIL_FORMAT(x) (x == FORMAT_DEPTH_24_STENCIL_8)
+#define IS_UINT_FORMAT(x) (x == FORMAT_R_U8 || x == FORMAT_RG_U8 || x == FORMAT_RGBA_U8)
+#define IS_SINT_FORMAT(x) (x == FORMAT_R_I8 || x == FORMAT_RG_I8 || x == FORMAT_RGBA_I8)
 
 typedef struct tex_fmt {
 	uint32_t format;
@@ -70,9 +72,18 @@ static tex_fmt tex_fmt_info[] = {
 #define GET_FORMAT_GL_FORMAT(x)				tex_fmt_info[x].gl_format
 #define GET_FORMAT_GL_TYPE(x)				tex_fmt_info[x].gl_type
 
+#define MAX_TEX_SPANS	5
+
+// box of texels within one mip level
+typedef struct tex_span_t {
+	uint32_t x, y, z;
+	uint32_t w, h, d;
+} tex_span_t;
+
 GLenum get_tex_gl_target(uint8_t n_dims);
 uint64_t get_tex_data_size(header_t* hdr);
 void upload_texture(object_t* obj, uint8_t* data);
+void download_texture(object_t* obj, GLuint gl_buffer);
 void read_texture(object_t* obj, uint8_t* dst, uint64_t src, uint64_t n);
 void write_texture(object_t* obj, uint64_t dst, uint8_t* src, uint64_t n);
 
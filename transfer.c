@@ -0,0 +1,194 @@
+#include "../../defs.h"
+
+GLuint blit_fbos[2];	// read and draw framebuffers for blit_texture()
+
+// get a buffer object holding all of [addr, addr + n - 1], 0 if there is none
+object_t* find_buffer(uint64_t addr, uint64_t n) {
+	region_query_t q;
+	uint32_t count = query_region(&q, addr, n);
+
+	object_t* found = 0;
+	for(uint32_t i = 0; i < count && !found; i++) {
+		object_t* obj = q.hits[i].obj;
+		if(obj->store && obj->addr <= addr && addr + n <= obj->addr + obj->len)
+			found = obj;
+	}
+
+	free_region_query(&q);
+	return found;
+}
+
+// record a write made on the GL side of obj. VRAM is left stale, it is
+// updated when the object is flushed like after any other GPU write.
+void gpu_side_write(object_t* obj, uint64_t addr, uint64_t n) {
+	mark_modified(obj, addr, n);
+	vram_written(addr, n);
+}
+
+// copy between VRAM ranges. when both lie in buffer objects the copy stays on
+// the GPU, otherwise it goes through gpu_read()/gpu_write().
+void copy_buffer(uint64_t dst, uint64_t src, uint64_t n) {
+	if(!n || src + n >= VRAM_CAPACITY || dst + n >= VRAM_CAPACITY) {
+		WARN("buffer copy [%llx, %llx] -> %llx out of VRAM bounds, skipping\n",
+			src, src + n - 1, dst);
+		return;
+	}
+
+	object_t* src_obj = find_buffer(src, n);
+	object_t* dst_obj = find_buffer(dst, n);
+
+	// copies within one GL buffer can't overlap
+	if(src_obj && dst_obj && (src_obj->store != dst_obj->store
+	|| !check_overlap(src, src + n - 1, dst, dst + n - 1))) {
+		flush_dirty(src_obj);
+		flush_dirty(dst_obj);
+
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_COPY_READ_BUFFER, src_obj->gl_buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, dst_obj->gl_buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+			src - src_obj->addr + src_obj->gl_offset,
+			dst - dst_obj->addr + dst_obj->gl_offset, n);
+		mark_gpu_use(src_obj);
+		mark_gpu_use(dst_obj);
+		gpu_side_write(dst_obj, dst, n);
+		return;
+	}
+
+	uint8_t* data = malloc(n);
+	gpu_read(data, src, n);
+	gpu_write(dst, data, n);
+	free(data);
+}
+
+// fill a VRAM range with a repeated 32-bit value
+void fill_buffer(uint64_t dst, uint64_t n, uint32_t value) {
+	if(!n || dst + n >= VRAM_CAPACITY) {
+		WARN("buffer fill [%llx, %llx] out of VRAM bounds, skipping\n",
+			dst, dst + n - 1);
+		return;
+	}
+	if(dst % 4 || n % 4) {
+		WARN("buffer fill [%llx, %llx] is not 4-byte aligned, skipping\n",
+			dst, dst + n - 1);
+		return;
+	}
+
+	object_t* obj = find_buffer(dst, n);
+	if(obj) {
+		flush_dirty(obj);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, obj->gl_buffer);
+		glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R32UI,
+			dst - obj->addr + obj->gl_offset, n, GL_RED_INTEGER,
+			GL_UNSIGNED_INT, &value);
+		mark_gpu_use(obj);
+		gpu_side_write(obj, dst, n);
+		return;
+	}
+
+	uint32_t* data = malloc(n);
+	for(uint64_t i = 0; i < n / 4; i++)
+		data[i] = value;
+	gpu_write(dst, (uint8_t*)data, n);
+	free(data);
+}
+
+GLbitfield get_blit_mask(uint8_t format) {
+	if(IS_DEPTH_FORMAT(format))
+		return GL_DEPTH_BUFFER_BIT;
+	if(IS_DEPTH_STENCIL_FORMAT(format))
+		return GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+	return GL_COLOR_BUFFER_BIT;
+}
+
+GLenum get_blit_attachment(uint8_t format) {
+	if(IS_DEPTH_FORMAT(format))
+		return GL_DEPTH_ATTACHMENT;
+	if(IS_DEPTH_STENCIL_FORMAT(format))
+		return GL_DEPTH_STENCIL_ATTACHMENT;
+	return GL_COLOR_ATTACHMENT0;
+}
+
+// blit a rectangle of level 0 of one 2D texture to another, scaling it to the
+// destination rectangle. rects are x, y, width, height.
+void blit_texture(uint64_t dst_addr, uint64_t src_addr, uint32_t dst_rect[4],
+	uint32_t src_rect[4], uint32_t flags) {
+	object_t* src = ref_buffer_precise(src_addr, TYPE_TBO, LENGTH_IN_BUFFER);
+	object_t* dst = ref_buffer_precise(dst_addr, TYPE_TBO, LENGTH_IN_BUFFER);
+	if(!src || !dst) {
+		WARN("failed to get textures %llx -> %llx for blit, skipping\n",
+			src_addr, dst_addr);
+		return;
+	}
+
+	if(src->header.n_dims != 2 || dst->header.n_dims != 2) {
+		WARN("blit textures %llx -> %llx must be 2D, skipping\n", src_addr, dst_addr);
+		return;
+	}
+
+	uint8_t src_fmt = src->header.tex_format, dst_fmt = dst->header.tex_format;
+	GLbitfield mask = get_blit_mask(src_fmt);
+	if(mask != GL_COLOR_BUFFER_BIT ? src_fmt != dst_fmt : !IS_COLOR_FORMAT(dst_fmt)) {
+		WARN("blit textures %llx -> %llx have incompatible formats, skipping\n",
+			src_addr, dst_addr);
+		return;
+	}
+	// integer colors only blit to the same class, never mixed with float or
+	// normalized ones
+	if(IS_UINT_FORMAT(src_fmt) != IS_UINT_FORMAT(dst_fmt)
+	|| IS_SINT_FORMAT(src_fmt) != IS_SINT_FORMAT(dst_fmt)) {
+		WARN("blit textures %llx -> %llx have different format classes, skipping\n",
+			src_addr, dst_addr);
+		return;
+	}
+	if((mask != GL_COLOR_BUFFER_BIT || IS_UINT_FORMAT(src_fmt)
+	|| IS_SINT_FORMAT(src_fmt)) && (flags & BLIT_LINEAR_BIT)) {
+		WARN("depth/stencil and integer blits must use nearest filtering, skipping\n");
+		return;
+	}
+
+	uint32_t* rects[2] = { src_rect, dst_rect };
+	object_t* tbos[2] = { src, dst };
+	for(uint32_t i = 0; i < 2; i++)
+		if(!rects[i][2] || !rects[i][3]
+		|| (uint64_t)rects[i][0] + rects[i][2] > tbos[i]->header.dims[0]
+		|| (uint64_t)rects[i][1] + rects[i][3] > tbos[i]->header.dims[1]) {
+			WARN("blit rectangle exceeds texture %llx, skipping\n", tbos[i]->addr);
+			return;
+		}
+
+	flush_dirty(src);
+	flush_dirty(dst);
+
+	if(!blit_fbos[0])
+		glGenFramebuffers(2, blit_fbos);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, blit_fbos[0]);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, get_blit_attachment(src_fmt),
+		GL_TEXTURE_2D, src->gl_buffer, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, blit_fbos[1]);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, get_blit_attachment(dst_fmt),
+		GL_TEXTURE_2D, dst->gl_buffer, 0);
+
+	uint8_t complete = glCheckFramebufferStatus(GL_READ_FRAMEBUFFER)
+		== GL_FRAMEBUFFER_COMPLETE && glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER)
+		== GL_FRAMEBUFFER_COMPLETE;
+	if(complete)
+		glBlitFramebuffer(src_rect[0], src_rect[1], src_rect[0] + src_rect[2],
+			src_rect[1] + src_rect[3], dst_rect[0], dst_rect[1],
+			dst_rect[0] + dst_rect[2], dst_rect[1] + dst_rect[3], mask,
+			(flags & BLIT_LINEAR_BIT) ? GL_LINEAR : GL_NEAREST);
+	else
+		WARN("blit framebuffers for %llx -> %llx incomplete, skipping\n",
+			src_addr, dst_addr);
+
+	// detach so deleting the textures doesn't leave them attached
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, get_blit_attachment(src_fmt),
+		GL_TEXTURE_2D, 0, 0);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, get_blit_attachment(dst_fmt),
+		GL_TEXTURE_2D, 0, 0);
+	mark_state_dirty(STATE_FBO);	// the render target was unbound
+
+	if(complete)
+		gpu_side_write(dst, dst->addr + dst->header_len, dst->len - dst->header_len);
+}
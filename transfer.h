@@ -0,0 +1,14 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "../../defs.h"
+
+#define BLIT_LINEAR_BIT		(1 << 0)
+
+GLenum get_blit_attachment(uint8_t format);
+void copy_buffer(uint64_t dst, uint64_t src, uint64_t n);
+void fill_buffer(uint64_t dst, uint64_t n, uint32_t value);
+void blit_texture(uint64_t dst_addr, uint64_t src_addr, uint32_t dst_rect[4],
+	uint32_t src_rect[4], uint32_t flags);
+
+#endif